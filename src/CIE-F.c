@@ -0,0 +1,85 @@
+static double CIE_F[81][13] = {
+
+  { 380, 1.87, 1.18, 0.82, 0.57, 1.87, 1.05, 2.56, 1.21, 0.90, 1.11, 0.91, 0.96 },
+  { 385, 2.36, 1.48, 1.02, 0.70, 2.35, 1.31, 3.18, 1.50, 1.12, 0.63, 0.63, 0.64 },
+  { 390, 2.94, 1.84, 1.26, 0.87, 2.92, 1.63, 3.84, 1.81, 1.36, 0.62, 0.46, 0.45 },
+  { 395, 3.47, 2.15, 1.44, 0.98, 3.45, 1.90, 4.53, 2.13, 1.60, 0.57, 0.37, 0.33 },
+  { 400, 5.17, 3.44, 2.57, 2.01, 5.10, 3.11, 6.15, 3.17, 2.59, 1.48, 1.29, 1.19 },
+  { 405, 19.49, 15.69, 14.36, 13.75, 18.91, 14.80, 19.37, 13.08, 12.80, 12.16, 12.68, 12.48 },
+  { 410, 6.13, 3.85, 2.70, 1.95, 6.00, 3.43, 7.37, 3.83, 3.05, 2.12, 1.59, 1.12 },
+  { 415, 6.24, 3.74, 2.45, 1.59, 6.11, 3.30, 7.05, 3.45, 2.56, 2.70, 1.79, 0.94 },
+  { 420, 7.01, 4.19, 2.73, 1.76, 6.85, 3.68, 7.71, 3.86, 2.86, 3.74, 2.46, 1.08 },
+  { 425, 7.79, 4.62, 3.00, 1.94, 7.58, 4.07, 8.41, 4.42, 3.30, 5.14, 3.33, 1.37 },
+  { 430, 8.56, 5.06, 3.28, 2.11, 8.31, 4.45, 9.15, 5.09, 3.82, 6.75, 4.49, 1.78 },
+  { 435, 43.67, 34.98, 31.85, 30.28, 40.76, 32.61, 44.14, 34.10, 32.62, 34.39, 33.94, 29.05 },
+  { 440, 16.94, 11.81, 9.47, 8.03, 16.06, 10.74, 17.52, 12.42, 10.77, 14.86, 12.13, 7.90 },
+  { 445, 10.72, 6.27, 4.02, 2.55, 10.32, 5.48, 11.35, 7.68, 5.84, 10.40, 6.95, 2.65 },
+  { 450, 11.35, 6.63, 4.25, 2.70, 10.91, 5.78, 12.00, 8.60, 6.57, 10.76, 7.19, 2.71 },
+  { 455, 11.89, 6.93, 4.44, 2.82, 11.40, 6.03, 12.58, 9.46, 7.25, 10.67, 7.12, 2.65 },
+  { 460, 12.37, 7.19, 4.59, 2.91, 11.83, 6.25, 13.08, 10.24, 7.86, 10.11, 6.72, 2.49 },
+  { 465, 12.75, 7.40, 4.72, 2.99, 12.17, 6.41, 13.45, 10.84, 8.35, 9.27, 6.13, 2.33 },
+  { 470, 13.00, 7.54, 4.80, 3.04, 12.40, 6.52, 13.71, 11.33, 8.75, 8.29, 5.46, 2.10 },
+  { 475, 13.15, 7.62, 4.86, 3.08, 12.54, 6.58, 13.88, 11.71, 9.06, 7.29, 4.79, 1.91 },
+  { 480, 13.23, 7.65, 4.87, 3.09, 12.58, 6.59, 13.95, 11.98, 9.31, 7.91, 5.66, 3.01 },
+  { 485, 13.17, 7.62, 4.85, 3.09, 12.52, 6.56, 13.93, 12.17, 9.48, 16.64, 14.29, 10.83 },
+  { 490, 13.13, 7.62, 4.88, 3.14, 12.47, 6.56, 13.82, 12.28, 9.61, 16.73, 14.96, 11.88 },
+  { 495, 12.85, 7.45, 4.77, 3.06, 12.20, 6.42, 13.64, 12.32, 9.68, 10.44, 8.97, 6.88 },
+  { 500, 12.52, 7.28, 4.67, 3.00, 11.89, 6.28, 13.43, 12.35, 9.74, 5.94, 4.72, 3.43 },
+  { 505, 12.20, 7.15, 4.62, 2.98, 11.61, 6.20, 13.25, 12.44, 9.88, 3.34, 2.33, 1.49 },
+  { 510, 11.83, 7.05, 4.62, 3.01, 11.33, 6.19, 13.08, 12.55, 10.04, 2.35, 1.47, 0.92 },
+  { 515, 11.50, 7.04, 4.73, 3.14, 11.10, 6.30, 12.93, 12.68, 10.26, 1.88, 1.10, 0.71 },
+  { 520, 11.22, 7.16, 4.99, 3.41, 10.96, 6.60, 12.78, 12.77, 10.48, 1.59, 0.89, 0.60 },
+  { 525, 11.05, 7.47, 5.48, 3.90, 10.97, 7.12, 12.60, 12.72, 10.63, 1.47, 0.83, 0.63 },
+  { 530, 11.03, 8.04, 6.25, 4.69, 11.16, 7.94, 12.44, 12.60, 10.76, 1.80, 1.18, 1.10 },
+  { 535, 11.18, 8.88, 7.34, 5.81, 11.54, 9.07, 12.33, 12.43, 10.96, 5.71, 4.90, 4.56 },
+  { 540, 11.53, 10.01, 8.78, 7.32, 12.12, 10.49, 12.26, 12.22, 11.18, 40.98, 39.59, 34.40 },
+  { 545, 27.74, 24.88, 23.82, 22.59, 27.78, 25.22, 29.52, 28.96, 27.71, 73.69, 72.84, 65.40 },
+  { 550, 17.05, 16.64, 16.14, 15.11, 17.73, 17.46, 17.05, 16.51, 16.29, 33.61, 32.61, 29.48 },
+  { 555, 13.55, 14.59, 14.59, 13.88, 14.47, 15.63, 12.44, 11.79, 12.28, 8.24, 7.52, 7.16 },
+  { 560, 14.33, 16.16, 16.63, 16.33, 15.20, 17.22, 12.58, 11.76, 12.74, 3.38, 2.83, 3.08 },
+  { 565, 15.01, 17.56, 18.49, 18.68, 15.77, 18.53, 12.72, 11.77, 13.21, 2.47, 1.96, 2.47 },
+  { 570, 15.52, 18.62, 19.95, 20.64, 16.10, 19.43, 12.83, 11.84, 13.65, 2.14, 1.67, 2.27 },
+  { 575, 18.29, 21.47, 23.11, 24.28, 18.54, 21.97, 15.46, 14.61, 16.57, 4.86, 4.43, 5.09 },
+  { 580, 19.55, 22.79, 24.69, 26.26, 19.50, 23.01, 16.75, 16.11, 18.14, 11.45, 11.28, 11.96 },
+  { 585, 15.48, 19.29, 21.41, 23.28, 15.39, 19.41, 12.83, 12.34, 14.55, 14.79, 14.76, 15.32 },
+  { 590, 14.91, 18.66, 20.85, 22.94, 14.64, 18.56, 12.67, 12.53, 14.65, 12.16, 12.73, 14.27 },
+  { 595, 14.15, 17.73, 19.93, 22.14, 13.72, 17.42, 12.45, 12.72, 14.66, 8.97, 9.74, 11.86 },
+  { 600, 13.22, 16.54, 18.67, 20.91, 12.69, 16.09, 12.19, 12.92, 14.61, 6.52, 7.33, 9.28 },
+  { 605, 12.19, 15.21, 17.22, 19.43, 11.57, 14.64, 11.89, 13.12, 14.50, 8.31, 9.72, 12.31 },
+  { 610, 11.12, 13.80, 15.65, 17.74, 10.45, 13.15, 11.60, 13.34, 14.39, 44.12, 55.27, 68.53 },
+  { 615, 10.03, 12.36, 14.04, 16.00, 9.35, 11.68, 11.35, 13.61, 14.40, 34.55, 42.58, 53.02 },
+  { 620, 8.95, 10.95, 12.45, 14.42, 8.29, 10.25, 11.12, 13.87, 14.47, 12.09, 13.18, 14.67 },
+  { 625, 7.96, 9.65, 10.95, 12.56, 7.32, 8.95, 10.95, 14.07, 14.62, 12.15, 13.16, 14.38 },
+  { 630, 7.02, 8.40, 9.51, 10.93, 6.41, 7.74, 10.76, 14.20, 14.72, 10.52, 12.26, 14.71 },
+  { 635, 6.20, 7.32, 8.27, 9.52, 5.63, 6.69, 10.42, 14.16, 14.55, 4.43, 5.11, 6.46 },
+  { 640, 5.42, 6.31, 7.11, 8.18, 4.90, 5.71, 10.11, 14.13, 14.40, 1.95, 2.07, 2.57 },
+  { 645, 4.73, 5.43, 6.09, 7.01, 4.26, 4.87, 10.04, 14.34, 14.58, 2.19, 2.34, 2.75 },
+  { 650, 4.15, 4.68, 5.22, 6.00, 3.72, 4.16, 10.02, 14.50, 14.88, 3.19, 3.58, 4.18 },
+  { 655, 3.64, 4.02, 4.45, 5.11, 3.25, 3.55, 10.11, 14.46, 15.51, 2.77, 3.01, 3.44 },
+  { 660, 3.20, 3.45, 3.80, 4.36, 2.83, 3.02, 9.87, 14.00, 15.47, 2.29, 2.48, 2.81 },
+  { 665, 2.81, 2.96, 3.23, 3.69, 2.49, 2.57, 8.65, 12.58, 13.20, 2.00, 2.14, 2.42 },
+  { 670, 2.47, 2.55, 2.75, 3.13, 2.19, 2.20, 7.27, 10.99, 10.57, 1.52, 1.54, 1.64 },
+  { 675, 2.18, 2.19, 2.33, 2.64, 1.93, 1.87, 6.44, 9.98, 9.18, 1.35, 1.33, 1.36 },
+  { 680, 1.93, 1.89, 1.99, 2.24, 1.71, 1.60, 5.83, 9.22, 8.25, 1.47, 1.46, 1.49 },
+  { 685, 1.72, 1.64, 1.70, 1.91, 1.52, 1.37, 5.41, 8.62, 7.57, 1.79, 1.94, 1.92 },
+  { 690, 1.67, 1.53, 1.55, 1.70, 1.48, 1.29, 5.04, 8.07, 7.03, 1.74, 2.00, 2.06 },
+  { 695, 1.43, 1.27, 1.27, 1.39, 1.26, 1.05, 4.57, 7.39, 6.35, 1.02, 1.20, 1.18 },
+  { 700, 1.29, 1.10, 1.09, 1.18, 1.13, 0.91, 4.12, 6.71, 5.72, 1.14, 1.35, 1.31 },
+  { 705, 1.19, 0.99, 0.96, 1.03, 1.05, 0.81, 3.77, 6.16, 5.25, 3.32, 4.10, 4.21 },
+  { 710, 1.08, 0.88, 0.83, 0.88, 0.96, 0.71, 3.46, 5.63, 4.80, 4.49, 5.58, 5.50 },
+  { 715, 0.96, 0.76, 0.71, 0.74, 0.85, 0.61, 3.08, 5.03, 4.29, 2.05, 2.51, 2.30 },
+  { 720, 0.88, 0.68, 0.62, 0.64, 0.78, 0.54, 2.73, 4.46, 3.80, 0.49, 0.57, 0.51 },
+  { 725, 0.81, 0.61, 0.54, 0.54, 0.72, 0.48, 2.47, 4.02, 3.43, 0.24, 0.27, 0.20 },
+  { 730, 0.77, 0.56, 0.49, 0.49, 0.68, 0.44, 2.25, 3.66, 3.12, 0.21, 0.23, 0.16 },
+  { 735, 0.75, 0.54, 0.46, 0.46, 0.67, 0.43, 2.06, 3.36, 2.86, 0.21, 0.21, 0.13 },
+  { 740, 0.73, 0.51, 0.43, 0.42, 0.65, 0.40, 1.90, 3.09, 2.64, 0.24, 0.24, 0.13 },
+  { 745, 0.68, 0.47, 0.39, 0.37, 0.61, 0.37, 1.75, 2.85, 2.43, 0.24, 0.24, 0.13 },
+  { 750, 0.69, 0.47, 0.39, 0.37, 0.62, 0.38, 1.62, 2.65, 2.26, 0.21, 0.20, 0.12 },
+  { 755, 0.64, 0.43, 0.35, 0.33, 0.59, 0.35, 1.54, 2.51, 2.14, 0.17, 0.24, 0.10 },
+  { 760, 0.68, 0.46, 0.38, 0.35, 0.62, 0.39, 1.45, 2.37, 2.02, 0.21, 0.32, 0.11 },
+  { 765, 0.69, 0.47, 0.39, 0.36, 0.64, 0.41, 1.32, 2.15, 1.83, 0.22, 0.26, 0.12 },
+  { 770, 0.61, 0.40, 0.33, 0.31, 0.55, 0.33, 1.17, 1.89, 1.61, 0.17, 0.16, 0.09 },
+  { 775, 0.52, 0.33, 0.28, 0.26, 0.47, 0.26, 0.99, 1.61, 1.38, 0.12, 0.12, 0.06 },
+  { 780, 0.43, 0.27, 0.21, 0.19, 0.40, 0.21, 0.81, 1.32, 1.12, 0.09, 0.09, 0.04 }
+
+};
@@ -22,13 +22,13 @@
 
 
 
-/* CIE XYZ->LAB conversion
+/* CIE XYZ->LAB conversion relative to the given white point
  */
-void XYZ2LAB( float X, float Y, float Z, float *L, float *a, float *b ){
+void XYZ2LAB( float X, float Y, float Z, const double *white, float *L, float *a, float *b ){
 
-  float var_X = X / X_D65;
-  float var_Y = Y / Y_D65;
-  float var_Z = Z / Z_D65;
+  float var_X = X / white[0];
+  float var_Y = Y / white[1];
+  float var_Z = Z / white[2];
 
   if ( var_X > 0.008856 ) var_X = cbrtf(var_X);
   else                    var_X = ( 7.787 * var_X ) + ( 16.0 / 116.0 );
@@ -97,3 +97,80 @@ void XYZ2RGB( float matrix[][3], float X, float Y, float Z, float *R, float *G,
   *B = ( b <= 0.0 ? 0.0 : b >= 1.0 ? 1.0 : b );
 }
 
+
+
+/* Bradford chromatic adaptation matrix from one white point to another
+ */
+void bradford_adaptation( const double *source, const double *destination, double adaptation[3][3] )
+{
+  static const double bradford[3][3] = {
+    {  0.8951,  0.2664, -0.1614 },
+    { -0.7502,  1.7135,  0.0367 },
+    {  0.0389, -0.0685,  1.0296 }
+  };
+  static const double inverse[3][3] = {
+    {  0.9869929, -0.1470543,  0.1599627 },
+    {  0.4323053,  0.5183603,  0.0492912 },
+    { -0.0085287,  0.0400428,  0.9684867 }
+  };
+  double scale[3];
+  int i, j, k;
+
+  /* Keep identical white points exact
+   */
+  if( source[0] == destination[0] && source[1] == destination[1] && source[2] == destination[2] ){
+    for( i=0; i<3; i++ ) for( j=0; j<3; j++ ) adaptation[i][j] = ( i == j ) ? 1.0 : 0.0;
+    return;
+  }
+
+  /* Ratio of the cone responses of our two white points
+   */
+  for( i=0; i<3; i++ ){
+    double s = 0.0, d = 0.0;
+    for( k=0; k<3; k++ ){
+      s += bradford[i][k] * source[k];
+      d += bradford[i][k] * destination[k];
+    }
+    scale[i] = d / s;
+  }
+
+  for( i=0; i<3; i++ ){
+    for( j=0; j<3; j++ ){
+      double sum = 0.0;
+      for( k=0; k<3; k++ ) sum += inverse[i][k] * scale[k] * bradford[k][j];
+      adaptation[i][j] = sum;
+    }
+  }
+}
+
+
+
+/* Combine the D65 XYZ to linear RGB matrix for sRGB (icc_profile 1) or AdobeRGB
+   (icc_profile 2) with an adaptation from the white point of our illuminant to D65
+ */
+void rgb_matrix( unsigned int icc_profile, double adaptation[3][3], float matrix[3][3] )
+{
+  float (*rgb)[3] = ( icc_profile == 2 ) ? XYZ_AdobeRGB_matrix_D65 : XYZ_sRGB_matrix_D65;
+  int i, j, k;
+
+  for( i=0; i<3; i++ ){
+    for( j=0; j<3; j++ ){
+      double sum = 0.0;
+      for( k=0; k<3; k++ ) sum += rgb[i][k] * adaptation[k][j];
+      matrix[i][j] = (float) sum;
+    }
+  }
+}
+
+
+
+/* Convert XYZ to gamma encoded sRGB (icc_profile 1) or AdobeRGB (icc_profile 2) using
+   a conversion matrix from rgb_matrix()
+*/
+void calculate_RGB( unsigned int icc_profile, float matrix[3][3], float *XYZ, float *RGB )
+{
+  XYZ2RGB( matrix, XYZ[0], XYZ[1], XYZ[2], &RGB[0], &RGB[1], &RGB[2] );
+
+  if( icc_profile == 2 ) AdobeRGB_Gamma( &RGB[0], &RGB[1], &RGB[2] );
+  else sRGB_Gamma( &RGB[0], &RGB[1], &RGB[2] );
+}
@@ -54,24 +54,12 @@ static float XYZ_sRGB_matrix_D65[3][3] = {
   { 0.0557101, -0.2040211, 1.0569959}
 };
 
-static float XYZ_sRGB_matrix_D50[3][3] = {
-  { 3.1338561, -1.6168667, -0.4906146},
-  {-0.9787684,  1.9161415,  0.0334540},
-  { 0.0719453, -0.2289914,  1.4052427}
-};
-
 static float XYZ_AdobeRGB_matrix_D65[3][3] = {
   { 2.0413690, -0.5649464, -0.3446944},
   {-0.9692660,  1.8760108,  0.0415560},
   { 0.0134474, -0.1183897,  1.0154096}
 };
 
-static float XYZ_AdobeRGB_matrix_D50[3][3] = {
-  { 1.9624274, -0.6105343, -0.3413404},
-  {-0.9787684,  1.9161415,  0.0334540},
-  { 0.0286869, -0.1406752,  1.3487655}
-};
-
 /*static float XYZ_DCIP3_matrix_D65[3][3] = {
   	  x 	  y 	  z
 R 	0.68 	0.32 	0.00
@@ -81,7 +69,10 @@ B 	0.15 	0.06 	0.79
 
 /* Color conversion functions
  */
-void XYZ2LAB( float, float, float, float*, float*, float* );
+void XYZ2LAB( float, float, float, const double*, float*, float*, float* );
 void XYZ2RGB( float m[][3], float, float, float, float*, float*, float* );
 void sRGB_Gamma( float*, float*, float* );
 void AdobeRGB_Gamma( float*, float*, float* );
+void bradford_adaptation( const double*, const double*, double[3][3] );
+void rgb_matrix( unsigned int, double[3][3], float[3][3] );
+void calculate_RGB( unsigned int, float[3][3], float*, float* );
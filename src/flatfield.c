@@ -0,0 +1,176 @@
+/*
+    Flat-field white and dark references
+
+    Copyright (c) 2015-2024, Ruven <ruven@users.sourceforge.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+
+*/
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include "flatfield.h"
+#include "spectral_tiff.h"
+
+
+
+/* Parse a reference given as lines:first-last for a range of scanlines of our cube,
+   region:x,y,width,height for a region of it, or otherwise the name of a separate
+   reference cube. Returns 1 if invalid
+ */
+int parse_reference( const char *spec, reference_source *source )
+{
+  unsigned int first, last;
+
+  memset( source, 0, sizeof(reference_source) );
+
+  if( strncmp( spec, "lines:", 6 ) == 0 ){
+    if( sscanf( spec + 6, "%u-%u", &first, &last ) != 2 || last < first ) return 1;
+    source->y = first;
+    source->height = last - first + 1;
+  }
+  else if( strncmp( spec, "region:", 7 ) == 0 ){
+    if( sscanf( spec + 7, "%u,%u,%u,%u", &source->x, &source->y, &source->width, &source->height ) != 4 ) return 1;
+    if( source->width == 0 || source->height == 0 ) return 1;
+  }
+  else if( spec[0] ) source->filename = spec;
+  else return 1;
+
+  return 0;
+}
+
+
+
+/* Open a separate reference cube, which must have the same width and bands as the
+   cube being rendered. Hyspex and spectral TIFF files are read through their headers
+   and anything else is taken as raw BIL in the same layout as our cube
+ */
+static FILE* open_reference( const char *filename, hyspex_header *cube, hyspex_header *header )
+{
+  FILE *file;
+  off_t size;
+
+  memset( header, 0, sizeof(hyspex_header) );
+
+  if( ! ( file = fopen( filename, "rb" ) ) ){
+    fprintf( stderr, "Unable to open reference file: '%s'\n", filename );
+    return NULL;
+  }
+
+  if( is_tiff( file ) ){
+    if( open_spectral_tiff( filename, header ) != 0 ){
+      fclose( file );
+      return NULL;
+    }
+  }
+  else if( is_hyspex( file, header ) ){
+    parse_hyspex_header( file, header );
+  }
+  else{
+    header->samples = cube->samples;
+    header->bands = cube->bands;
+    header->bpp = cube->bpp;
+    fseeko( file, 0, SEEK_END );
+    size = ftello( file );
+    header->scanlines = size / ( (off_t)header->bpp * header->samples * header->bands );
+  }
+
+  if( header->samples != cube->samples || header->bands != cube->bands || header->scanlines == 0 ){
+    fprintf( stderr, "Reference file must have %u samples and %u bands: '%s'\n", cube->samples, cube->bands, filename );
+    close_spectral_tiff( header );
+    free_hyspex( header );
+    fclose( file );
+    return NULL;
+  }
+
+  /* A reference from the same detector shares its bad columns
+   */
+  header->mask = cube->mask;
+
+  return file;
+}
+
+
+
+/* Average a reference over its scanlines in a single streaming pass, giving the mean
+   of each band for each column as mean[column*bands + band]. Values are scaled as
+   they are for rendering. Columns outside of a reference region take the mean of
+   the nearest column within it
+ */
+int average_reference( FILE *in, hyspex_header *header, reference_source *source, double *mean )
+{
+  hyspex_header reference;
+  hyspex_header *h = header;
+  FILE *file = in;
+  unsigned short *scanline;
+  unsigned int bands = header->bands, samples = header->samples;
+  unsigned int x0, x1, j, x, k;
+  double scale;
+  int status = 0;
+
+  if( source->filename ){
+    if( ! ( file = open_reference( source->filename, header, &reference ) ) ) return 1;
+    h = &reference;
+    source->x = source->y = source->width = 0;
+    source->height = reference.scanlines;
+  }
+
+  x0 = source->x;
+  x1 = source->width ? source->x + source->width : samples;
+  if( x1 > samples || source->y + source->height > h->scanlines ){
+    fprintf( stderr, "Reference region lies outside of the %ux%u cube\n", samples, h->scanlines );
+    status = 1;
+    goto cleanup;
+  }
+
+  memset( mean, 0, sizeof(double) * samples * bands );
+  scanline = malloc( sizeof(unsigned short) * samples * bands );
+
+  for( j=source->y; j<source->y + source->height; j++ ){
+    if( load_hyspex_bil( file, h, scanline, j ) != (size_t)samples*bands ){
+      fprintf( stderr, "Unable to read reference scanline %u\n", j );
+      status = 1;
+      break;
+    }
+    for( k=0; k<bands; k++ ){
+      const unsigned short *band = scanline + (size_t)k * samples;
+      for( x=x0; x<x1; x++ ) mean[(size_t)x*bands + k] += band[x];
+    }
+  }
+  free( scanline );
+
+  scale = 1.0 / source->height;
+  if( h->bpp == 2 ) scale /= 65535.0;
+
+  for( x=x0; x<x1; x++ ){
+    for( k=0; k<bands; k++ ) mean[(size_t)x*bands + k] *= scale;
+  }
+  for( x=0; x<samples; x++ ){
+    if( x >= x0 && x < x1 ) continue;
+    memcpy( mean + (size_t)x*bands, mean + (size_t)( ( x < x0 ) ? x0 : x1-1 ) * bands, sizeof(double) * bands );
+  }
+
+ cleanup:
+  if( file != in ){
+    close_spectral_tiff( &reference );
+    free_hyspex( &reference );
+    fclose( file );
+  }
+
+  return status;
+}
@@ -0,0 +1,48 @@
+/*
+    Flat-field white and dark reference sources
+
+    Copyright (c) 2015-2024, Ruven <ruven@users.sourceforge.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+
+*/
+
+
+
+#ifndef FLATFIELD_H
+#define FLATFIELD_H
+
+
+#include <stdio.h>
+#include "hyspex.h"
+
+
+/* A white or dark reference: a range of scanlines or a region of the cube being
+   rendered, or a separate reference cube averaged over all of its scanlines
+ */
+typedef struct {
+  const char *filename;       /* Separate reference cube or NULL for our own cube */
+  unsigned int x;             /* Region within our own cube */
+  unsigned int y;
+  unsigned int width;         /* Width of the region or 0 for whole scanlines */
+  unsigned int height;
+} reference_source;
+
+
+int parse_reference( const char*, reference_source* );
+int average_reference( FILE*, hyspex_header*, reference_source*, double* );
+
+
+#endif
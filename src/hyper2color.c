@@ -33,23 +33,58 @@
 
 #include <math.h>
 #include <sys/mman.h>
-#include <gsl/gsl_errno.h>
-#include <gsl/gsl_spline.h>
-#include <gsl/gsl_integration.h>
 #include "tiffio.h"
 
 /* Load our colorimetric matrices and functions
  */
 #include "color.h"
-#include "CIE-tristimulus.c"
-#include "CIE-D65.c"
-#include "CIE-A.c"
-#include "icc.c"
+#include "weights.h"
+#include "metamerism.h"
+#include "flatfield.h"
+#include "mask.h"
 
 
-/* Load our hyspex header library
+/* Load our hyspex header library and spectral TIFF input
  */
 #include "hyspex.h"
+#include "spectral_tiff.h"
+
+
+/* Output image routines
+ */
+#include "output.h"
+#include "resize.h"
+
+
+
+/* Codes for long options without a short option
+ */
+#define OPT_STRIP_ROWS 256
+#define OPT_PREDICTOR 257
+#define OPT_DEFLATE_LEVEL 258
+#define OPT_BIGTIFF 259
+#define OPT_PYRAMID 260
+#define OPT_RESIZE 261
+#define OPT_RESIZE_FILTER 262
+#define OPT_FORMAT 263
+#define OPT_JPEG_QUALITY 264
+#define OPT_JPEG_SUBSAMPLING 265
+#define OPT_ROTATE 266
+#define OPT_FLIP 267
+#define OPT_ADD_OUTPUT 268
+#define OPT_METAMERISM 269
+#define OPT_DELTA_E 270
+#define OPT_OBSERVER 271
+#define OPT_SMOOTH 272
+#define OPT_SRF 273
+#define OPT_FWHM 274
+#define OPT_SMILE 275
+#define OPT_WHITE_REF 276
+#define OPT_DARK_REF 277
+#define OPT_MASK 278
+#define OPT_ALPHA 279
+#define OPT_CAMERA 280
+#define OPT_CORRECTION 281
 
 
 
@@ -64,25 +99,87 @@ void help( void ){
  Generate colorimetric rendering of hyperspectral reflectance data with \n \
  requested illuminant or color temperature in sRGB, AdobeRGB or CIE L*a*b* color \n \
  output space. Output is in TIFF format using requested compression.\n\n \
- Requested color temperature can be a standard temperature (D65, D50, D75, D93, A)\n \
- or a temperature in degrees Kelvin (eg: 5000 for a temperature of 5000K)\n \
- Alternatively, an artibrary illuminant power spectrum can be provided \n \
- containing a list of wavelengths and power values\n\n \
+ Requested illuminant can be CIE A, E, D65 or any other daylight illuminant\n \
+ (D50, D55, D75, D93 or in Kelvin, eg: D6000), a fluorescent illuminant F1-F12\n \
+ or a blackbody temperature in degrees Kelvin (eg: 5000 for a temperature of\n \
+ 5000K). Alternatively, an arbitrary illuminant power spectrum can be provided\n \
+ containing a list of wavelengths and power values at any sampling\n\n \
  Output bits per channel can be 8, 16 or 32 bits, where 8 and 16 are encoded\n \
- as unsigned integer and 32 is encoded as floating point\n\n \
+ as unsigned integer and 32 is encoded as floating point. 16f gives 16 bit\n \
+ half precision floating point\n\n \
  eg: hyper2color -i data.img -o calibrated_color.tif -t D65 \n\n \
  Options:\n\n \
-  --input,       -i:  input hyperspectral cube\n \
-  --output,      -o:  output TIFF image\n \
-  --temperature, -t:  output color temperature: D65 (default), D50 or temperature in K)\n \
-  --colorspace,  -s:  output color space: CIELAB, sRGB (default) or AdobeRGB\n \
+  --input,       -i:  input hyperspectral cube: Hyspex, raw BIL or spectral TIFF\n \
+  --output,      -o:  output image or - for standard output\n \
+  --temperature, -t:  output illuminant: D65 (default), D50, A, F11 or temperature in K\n \
+  --colorspace,  -s:  output color space: CIELAB, sRGB (default), AdobeRGB or XYZ\n \
+                      (XYZ for raw, PFM or NPY output only)\n \
   --power,       -p:  illuminant power spectrum file (optional)\n \
-  --bits,        -b:  output bits per channel: 8 (default), 16 or 32 bits\n \
+  --observer        :  standard observer: 2 (CIE 1931, default) or 10 (CIE 1964)\n \
+  --smooth          :  smooth spectra before rendering with a Savitzky-Golay filter\n \
+                      over an odd number of bands and polynomial order (default 2)\n \
+                      or a Gaussian of given standard deviation in nm\n \
+                      (eg: sg:7, sg:11:3 or gaussian:5)\n \
+  --srf             :  band spectral response: gaussian, using the fwhm of each band\n \
+                      from the ENVI header or --fwhm, or a file with a wavelength\n \
+                      followed by the response of each band on each line\n \
+  --fwhm            :  comma separated band widths in nm, or one width for all bands\n \
+                      (implies --srf gaussian)\n \
+  --smile           :  spectral smile correction: a file with the wavelength of each\n \
+                      band for each column on each line, or poly: followed by comma\n \
+                      separated polynomial coefficients of the wavelength shift in\n \
+                      nm across columns scaled from -1 to 1 (eg: poly:0.8,0,-1.6)\n \
+  --white-ref       :  white reference for conversion to reflectance, averaged for\n \
+                      each column: lines:first-last or region:x,y,width,height of\n \
+                      the input, or a separate reference cube\n \
+  --dark-ref        :  dark reference subtracted before reflectance conversion, given\n \
+                      in the same way as --white-ref\n \
+  --mask            :  file of bad bands, columns and detector pixels, one per line\n \
+                      as: band N, column N (or a range N-M) or pixel column band.\n \
+                      Bad bands are left out and the others are interpolated\n \
+  --camera          :  simulate a camera from a file with a wavelength followed by its\n \
+                      red, green and blue sensitivities on each line, which replace\n \
+                      the observer. Camera RGB takes the place of XYZ unless corrected\n \
+  --camera-correction: camera RGB to XYZ correction: a file with 3 rows of 3 (matrix),\n \
+                      6 or 13 (root-polynomial of degree 2 or 3) coefficients for\n \
+                      camera RGB scaled so that green is 1 for a perfect white\n \
+  --alpha           :  add an alpha channel to rendered outputs, which is transparent\n \
+                      for pixels saturated in any band or zero in every band\n \
+  --bits,        -b:  output bits per channel: 8 (default), 16, 32 or 16f (half float)\n \
   --width,       -x:  hyperspectral image width\n \
   --height,      -y:  hyperspectral image height\n \
   --channels,    -c:  number of bands in hyperspectral cube\n \
   --wavelengths, -w:  list of center wavelengths for each band\n \
   --compression  -m:  TIFF output compression: none (default), deflate, lzw or jpeg\n \
+  --tile,        -T:  write a tiled TIFF with the given tile size (eg: 256)\n \
+  --strip-rows      :  number of rows per TIFF strip\n \
+  --predictor       :  compression predictor: none (default), horizontal or float\n \
+  --deflate-level   :  deflate compression level from 1 (fastest) to 9 (smallest)\n \
+  --jpeg-quality    :  JPEG quality from 1 to 100 (default: 75)\n \
+  --jpeg-subsampling:  JPEG chroma subsampling: 420 (default) or 444\n \
+  --bigtiff         :  BigTIFF output: auto (default, when over 4GB), yes or no\n \
+  --pyramid         :  tiled multi-resolution pyramid output for IIPImage\n \
+  --resize          :  resize output to WxH pixels (0 for either keeps the aspect\n \
+                      ratio) or by scale factors (eg: 0.5 or 1x1.25)\n \
+  --resize-filter   :  resampling filter: lanczos (default), bicubic or box\n \
+  --format          :  output file type: tiff, raw, ppm, pgm, pfm or npy (default:\n \
+                      from the output file extension, or raw for standard output)\n \
+  --rotate          :  rotate TIFF output clockwise by 90, 180 or 270 degrees\n \
+  --flip            :  mirror output left to right (before any rotation)\n \
+  --add-output      :  render an additional output in the same pass, given as a\n \
+                      file name and any settings to change: t=illuminant,\n \
+                      s=colorspace, b=bits, m=compression or format=type\n \
+                      (eg: preview.tif,b=8,m=jpeg or lab.tif,t=D50,s=CIELAB)\n \
+  --metamerism      :  write a floating point map of the color difference of each\n \
+                      pixel between the first of a list of illuminants and each\n \
+                      of the others (eg: D65,A) and print summary statistics\n \
+  --delta-e         :  color difference formula for metamerism maps: 76 or 2000\n \
+                      (default)\n \
+  --bin,         -n:  average blocks of NxM pixels before color rendering (eg: 2x2)\n \
+  --probe,       -P:  file of x,y pixel coordinates to sample: writes spectra and\n \
+                      colors as CSV or as JSON if the output file ends in .json\n \
+  --manifest,    -M:  file of regions to extract in a single pass, one per line as:\n \
+                      x y width height scale colorspace output.tif\n \
   --help,        -h:  this help message\n \
   --verbose,     -v:  verbose output\n\n\n" );
 }
@@ -90,94 +187,794 @@ void help( void ){
 
 
 
-/* Function to calculate the blackbody spectrum for a particular temperature
-   for the desired wavelength, which should be given in nm
+/* Parse the name of an output color space into a TIFF photometric interpretation
+   and output color profile. Unknown names default to sRGB
 */
-double calculate_power_spectrum( int bbTemp, int wavelength ){
+void parse_colorspace( const char *name, uint16_t *colorspace, unsigned int *icc_profile )
+{
+  if( strncasecmp( name, "CIELAB", 64 ) == 0 ){
+    *colorspace = PHOTOMETRIC_CIELAB;
+    *icc_profile = 0;
+  }
+  else if( strncasecmp( name, "XYZ", 64 ) == 0 ){
+    *colorspace = COLORSPACE_XYZ;
+    *icc_profile = 0;
+  }
+  else if( strncasecmp( name, "AdobeRGB", 64 ) == 0 ){
+    *colorspace = PHOTOMETRIC_RGB;
+    *icc_profile = 2;
+  }
+  else{
+    *colorspace = PHOTOMETRIC_RGB;
+    *icc_profile = 1;
+  }
+}
+
+
+
+/* Parse a spectral smoothing filter given as sg:window[:order] for Savitzky-Golay
+   or gaussian:sigma in nm. Returns 1 if invalid
+*/
+int parse_smoothing( const char *spec, render_options *options )
+{
+  unsigned int window, order = 2;
+  double sigma;
+
+  if( sscanf( spec, "sg:%u:%u", &window, &order ) >= 1 ){
+    if( window < 3 || window % 2 == 0 || order >= window ) return 1;
+    options->smooth = SMOOTH_SAVITZKY_GOLAY;
+    options->smooth_window = window;
+    options->smooth_order = order;
+  }
+  else if( sscanf( spec, "gaussian:%lf", &sigma ) == 1 ){
+    if( sigma <= 0.0 ) return 1;
+    options->smooth = SMOOTH_GAUSSIAN;
+    options->smooth_sigma = sigma;
+  }
+  else return 1;
+
+  return 0;
+}
+
+
+
+/* Parse an output bit depth of 8, 16, 32 or 16f for half float. Returns 1 and leaves
+   the depth unchanged if unsupported
+*/
+int parse_bits( const char *name, int *bits, int *half_float )
+{
+  int n = atoi( name );
+
+  if( strcasecmp( name, "16f" ) == 0 ){
+    *bits = 16;
+    *half_float = 1;
+  }
+  else if( n == 8 || n == 16 || n == 32 ){
+    *bits = n;
+    *half_float = 0;
+  }
+  else return 1;
+
+  return 0;
+}
 
-  double power;
-  double wlm = wavelength * 1e-9;  /* Convert from nm to meters */
-  power = 3.74177152e-16  /
-    ( pow( wlm, 5 ) * ( exp( 0.0143877696 / (wlm * bbTemp) ) - 1.0 ) );
 
-  return power;
+
+/* Parse the name of a TIFF compression scheme. Returns 1 and leaves the compression
+   unchanged if unknown
+*/
+int parse_compression( const char *name, short *compression )
+{
+  if( strcasecmp( name, "none" ) == 0 ) *compression = COMPRESSION_NONE;
+  else if( strcasecmp( name, "deflate" ) == 0 ) *compression = COMPRESSION_ADOBE_DEFLATE;
+  else if( strcasecmp( name, "lzw" ) == 0 ) *compression = COMPRESSION_LZW;
+  else if( strcasecmp( name, "jpeg" ) == 0 ) *compression = COMPRESSION_JPEG;
+  else return 1;
+
+  return 0;
 }
 
 
 
-void calculate_XYZ( hyspex_header *header, double *spectrum, double **power_spectrum, double **cie_color_match )
+/* Sample the pixels listed in probe_file as x,y coordinates, one per line, and write
+   each spectrum together with its XYZ, L*a*b* and RGB values to output_file as CSV
+   or as JSON if the file name ends in .json. Output goes to stdout if no output file
+   is given. RGB values are in sRGB unless AdobeRGB output is requested
+*/
+int probe_pixels( FILE *in, hyspex_header *header, const char *probe_file, const char *output_file,
+		  render_weights *weights, unsigned int icc_profile, int verbose )
 {
+  FILE *probes = NULL;
+  FILE *out = stdout;
+  hyspex_coord *coords = NULL;
+  double *spectra = NULL;
+  char line[256];
+  int count = 0, allocated = 0;
+  int json = 0;
+  int n;
+  unsigned int k, x, y;
+  double adaptation[3][3];
+  float matrix[3][3];
+
+  if( ! ( probes = fopen( probe_file, "r" ) ) ){
+    fprintf( stderr, "Unable to open probe file: '%s'\n", probe_file );
+    return 1;
+  }
 
-  /* Interpolate using GSL
+  /* Read our list of coordinates, skipping blank lines and comments
    */
-  gsl_interp_accel *acc = gsl_interp_accel_alloc();
-  gsl_spline *spline = gsl_spline_alloc( gsl_interp_cspline, header->bands );
-  gsl_spline_init( spline, header->wavelengths, spectrum, header->bands );
+  while( fgets( line, sizeof(line), probes ) ){
+    if( line[0] == '#' ) continue;
+    if( sscanf( line, "%u%*[ ,\t]%u", &x, &y ) != 2 ) continue;
+    if( count == allocated ){
+      allocated = allocated ? allocated*2 : 1024;
+      coords = realloc( coords, sizeof(hyspex_coord) * allocated );
+    }
+    coords[count].x = x;
+    coords[count].y = y;
+    coords[count].index = count;
+    count++;
+  }
+  fclose( probes );
 
+  if( verbose ) printf( "Sampling %d pixels\n", count );
 
-  int firstwav = 410;
+  /* Load all our spectra in a single pass through the scanlines they lie on. The
+     loader sorts the coordinates it is given, so pass it a copy of our list
+   */
+  hyspex_coord *sorted = malloc( sizeof(hyspex_coord) * (count ? count : 1) );
+  memcpy( sorted, coords, sizeof(hyspex_coord) * count );
+  spectra = malloc( sizeof(double) * header->bands * (count ? count : 1) );
+  n = load_hyspex_pixels( in, header, sorted, count, spectra );
+  free( sorted );
+  if( n != 0 ){
+    free( coords );
+    free( spectra );
+    return 1;
+  }
 
-  int tr = firstwav - cie_color_match[0][0];
-  int te = firstwav - power_spectrum[0][0];
+  if( output_file ){
+    size_t len = strlen( output_file );
+    if( len > 5 && strcasecmp( output_file + len - 5, ".json" ) == 0 ) json = 1;
+    if( ! ( out = fopen( output_file, "w" ) ) ){
+      fprintf( stderr, "Unable to open output file: '%s'\n", output_file );
+      free( coords );
+      free( spectra );
+      return 1;
+    }
+  }
+
+  bradford_adaptation( weights->white, weights->reference, adaptation );
+  rgb_matrix( icc_profile == 2 ? 2 : 1, adaptation, matrix );
 
+  if( json ) fprintf( out, "[\n" );
+  else{
+    fprintf( out, "x,y,X,Y,Z,L,a,b,R,G,B" );
+    for( k=0; k<header->bands; k++ ) fprintf( out, ",%g", header->wavelengths[k] );
+    fprintf( out, "\n" );
+  }
 
-  double X, Y, Z, norm;
-  X = Y = Z = norm = 0.0;
+  for( n=0; n<count; n++ ){
 
-  int k;
-  for( k=0; k<=830-firstwav; k+=5 ){
+    double *spectrum = spectra + (size_t)n * header->bands;
+    hyspex_coord *c = &coords[n];
+    float XYZ[3], Lab[3], RGB[3];
 
-    double val = gsl_spline_eval(spline, k, acc);
-    if( val < 0 ) val = 0.0;
+    apply_weights( weights, c->x, spectrum, XYZ );
+    XYZ2LAB( XYZ[0], XYZ[1], XYZ[2], weights->white, &Lab[0], &Lab[1], &Lab[2] );
+    calculate_RGB( icc_profile == 2 ? 2 : 1, matrix, XYZ, RGB );
 
-    X += val * cie_color_match[tr+k][1] * power_spectrum[te+k][1];
-    Y += val * cie_color_match[tr+k][2] * power_spectrum[te+k][1];
-    Z += val * cie_color_match[tr+k][3] * power_spectrum[te+k][1];
-    norm += cie_color_match[tr+k][2] * power_spectrum[te+k][1];
+    if( json ){
+      fprintf( out, "  { \"x\": %u, \"y\": %u, \"XYZ\": [%.4f, %.4f, %.4f], \"Lab\": [%.4f, %.4f, %.4f], "
+	       "\"RGB\": [%.6f, %.6f, %.6f], \"spectrum\": [",
+	       c->x, c->y, XYZ[0], XYZ[1], XYZ[2], Lab[0], Lab[1], Lab[2], RGB[0], RGB[1], RGB[2] );
+      for( k=0; k<header->bands; k++ ) fprintf( out, k ? ", %.6f" : "%.6f", spectrum[k] );
+      fprintf( out, "] }%s\n", ( n < count-1 ) ? "," : "" );
+    }
+    else{
+      fprintf( out, "%u,%u,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.6f,%.6f,%.6f",
+	       c->x, c->y, XYZ[0], XYZ[1], XYZ[2], Lab[0], Lab[1], Lab[2], RGB[0], RGB[1], RGB[2] );
+      for( k=0; k<header->bands; k++ ) fprintf( out, ",%.6f", spectrum[k] );
+      fprintf( out, "\n" );
+    }
   }
 
-  /* Free our interpolator
+  if( json ) fprintf( out, "]\n" );
+
+  if( out != stdout ) fclose( out );
+  free( coords );
+  free( spectra );
+
+  return 0;
+}
+
+
+
+/* Region of the cube extracted to its own output image in manifest mode
+ */
+typedef struct {
+  unsigned int x, y, width, height;   /* Region of the input cube */
+  int scale;                          /* Reduction factor */
+  char filename[1024];
+  output_format format;
+  output_writer *writer;
+  float *XYZ;                         /* XYZ values accumulated for the current output line */
+  void *color;                        /* Encoded output line */
+  int lines;                          /* Number of input lines accumulated so far */
+  unsigned int row;                   /* Current output row */
+} region;
+
+
+
+/* Load a manifest of regions, one per line as: x y width height scale colorspace output.
+   Output settings not given in the manifest are taken from defaults. Returns the number
+   of regions or -1 on error
+*/
+int load_manifest( const char *manifest_file, hyspex_header *header, output_format *defaults, region **regions )
+{
+  FILE *manifest;
+  char line[1280], space[64];
+  int count = 0, allocated = 0;
+  region r;
+
+  if( ! ( manifest = fopen( manifest_file, "r" ) ) ){
+    fprintf( stderr, "Unable to open manifest file: '%s'\n", manifest_file );
+    return -1;
+  }
+
+  *regions = NULL;
+
+  while( fgets( line, sizeof(line), manifest ) ){
+
+    if( line[0] == '#' ) continue;
+    if( sscanf( line, "%u %u %u %u %d %63s %1023s", &r.x, &r.y, &r.width, &r.height,
+		&r.scale, space, r.filename ) != 7 ) continue;
+
+    /* Clip to our image
+     */
+    if( r.x >= header->samples || r.y >= header->scanlines || r.width == 0 || r.height == 0 ){
+      fprintf( stderr, "Region %ux%u+%u+%u for '%s' lies outside the image\n", r.width, r.height, r.x, r.y, r.filename );
+      fclose( manifest );
+      free( *regions );
+      return -1;
+    }
+    if( r.x + r.width > header->samples ) r.width = header->samples - r.x;
+    if( r.y + r.height > header->scanlines ) r.height = header->scanlines - r.y;
+    if( r.scale < 1 ) r.scale = 1;
+
+    r.format = *defaults;
+    parse_colorspace( space, &r.format.colorspace, &r.format.icc_profile );
+    r.format.width = (r.width + r.scale - 1) / r.scale;
+    r.format.height = (r.height + r.scale - 1) / r.scale;
+    r.format.x_resolution = 150.0 / r.scale;
+    r.format.y_resolution = 150.0 / r.scale;
+    r.writer = NULL;
+    r.XYZ = NULL;
+    r.color = NULL;
+    r.lines = 0;
+    r.row = 0;
+
+    if( count == allocated ){
+      allocated = allocated ? allocated*2 : 64;
+      *regions = realloc( *regions, sizeof(region) * allocated );
+    }
+    (*regions)[count++] = r;
+  }
+
+  fclose( manifest );
+
+  return count;
+}
+
+
+
+/* Extract all our regions in a single sequential pass through the cube. Each scanline
+   is read and rendered to XYZ once across the span of the regions which intersect it.
+   The XYZ values are then averaged over blocks of each region's scale factor and
+   encoded into that region's color space
+*/
+int extract_regions( FILE *in, hyspex_header *header, region *regions, int count,
+		     render_weights *weights, int verbose )
+{
+  unsigned int first = header->scanlines, last = 0;
+  unsigned int i, j, k;
+  int n, status = 0;
+  double *spectrum = NULL;
+  unsigned short *scanline_spectrum = NULL;
+  float *line_XYZ = NULL;
+
+  /* Open our outputs and find the range of scanlines we need
    */
-  gsl_spline_free (spline);
-  gsl_interp_accel_free (acc);
+  for( n=0; n<count; n++ ){
+    region *r = &regions[n];
+    if( ! ( r->writer = open_output( r->filename, &r->format ) ) ){
+      fprintf( stderr, "Unable to open output image file: '%s'\n", r->filename );
+      status = 1;
+      goto cleanup;
+    }
+    r->XYZ = calloc( r->format.width * 3, sizeof(float) );
+    r->color = malloc( output_pixel_size(&r->format) * r->format.width );
+    if( r->y < first ) first = r->y;
+    if( r->y + r->height > last ) last = r->y + r->height;
+  }
+
+  scanline_spectrum = malloc( header->samples * sizeof(unsigned short) * header->bands );
+  spectrum = malloc( sizeof(double) * header->bands );
+  line_XYZ = malloc( header->samples * sizeof(float) * 3 );
 
-  float XX = (float)( (X * 100.0) / (norm) );
-  float YY = (float)( (Y * 100.0) / (norm) );
-  float ZZ = (float)( (Z * 100.0) / (norm) );
+  for( j=first; j<last; j++ ){
+
+    /* Find the span of samples covered by the regions on this scanline
+     */
+    unsigned int x0 = header->samples, x1 = 0;
+    for( n=0; n<count; n++ ){
+      region *r = &regions[n];
+      if( j < r->y || j >= r->y + r->height ) continue;
+      if( r->x < x0 ) x0 = r->x;
+      if( r->x + r->width > x1 ) x1 = r->x + r->width;
+    }
+    if( x0 >= x1 ) continue;
+
+    if( load_hyspex_bil( in, header, scanline_spectrum, j ) != (size_t)header->samples*header->bands ){
+      fprintf( stderr, "Unable to read scanline %u\n", j );
+      status = 1;
+      break;
+    }
+
+    for( i=x0; i<x1; i++ ){
+      for( k=0; k<header->bands; k++ ){
+	size_t p = i + (size_t)header->samples*k;
+	if( header->bpp == 2 ) spectrum[k] = (double)scanline_spectrum[p] / 65535.0;
+	else spectrum[k] = (double)scanline_spectrum[p];
+      }
+      apply_weights( weights, i, spectrum, &line_XYZ[i*3] );
+    }
 
+    /* Route our rendered pixels to each region intersecting this scanline
+     */
+    for( n=0; n<count; n++ ){
+
+      region *r = &regions[n];
+      if( j < r->y || j >= r->y + r->height ) continue;
+
+      for( i=0; i<r->width; i++ ){
+	float *xyz = &r->XYZ[(i/r->scale)*3];
+	xyz[0] += line_XYZ[(r->x+i)*3];
+	xyz[1] += line_XYZ[(r->x+i)*3 + 1];
+	xyz[2] += line_XYZ[(r->x+i)*3 + 2];
+      }
+      r->lines++;
+
+      /* Write out once we have a complete block of lines
+       */
+      if( r->lines == r->scale || j == r->y + r->height - 1 ){
+
+	for( i=0; i<r->format.width; i++ ){
+	  int columns = ( (i+1) * r->scale > r->width ) ? r->width - i*r->scale : r->scale;
+	  float pixels = (float)( columns * r->lines );
+	  r->XYZ[i*3] /= pixels;
+	  r->XYZ[i*3 + 1] /= pixels;
+	  r->XYZ[i*3 + 2] /= pixels;
+	}
+
+	encode_colors( &r->format, r->XYZ, NULL, r->color, r->format.width );
+
+	if( write_output_line( r->writer, r->color ) != 0 ){
+	  fprintf( stderr, "TIFF write error at scanline %d of '%s'\n", r->row, r->filename );
+	  status = 1;
+	}
+	r->row++;
+	r->lines = 0;
+	memset( r->XYZ, 0, r->format.width * 3 * sizeof(float) );
+      }
+    }
+
+    /* Report progress
+     */
+    if( verbose ){
+      printf( "Processing: %3d\%%\r", (int)((j-first)*100.0/(last-first)) );
+      fflush( stdout );
+    }
+  }
+
+
+ cleanup:
+  free( scanline_spectrum );
+  free( spectrum );
+  free( line_XYZ );
+  for( n=0; n<count; n++ ){
+    if( regions[n].writer && close_output( regions[n].writer ) != 0 ) status = 1;
+    free( regions[n].XYZ );
+    free( regions[n].color );
+  }
+
+  return status;
 }
 
-typedef struct { gsl_spline* s; gsl_interp_accel *a; double *cie; double *power; } my_f_params;
 
 
-double f( double x, void *p ){
-   my_f_params *params = (my_f_params*) p;
-   gsl_spline* spline = (gsl_spline*) params->s;
-   gsl_interp_accel* acc = (gsl_interp_accel*) params->a;
-   double* match = (double*) params->cie;
-   double* power = (double*) params->power;
+/* Accumulate a BIL scanline into a line of binned spectra by summing each block
+   of bin_x neighbouring samples band by band
+*/
+void accumulate_bil( hyspex_header *header, unsigned short *scanline, double *binned, int bin_x )
+{
+  unsigned int width = (header->samples + bin_x - 1) / bin_x;
+  unsigned int i, k;
+
+  for( k=0; k<header->bands; k++ ){
+    unsigned short *in = scanline + (size_t)k * header->samples;
+    double *out = binned + (size_t)k * width;
+    for( i=0; i<header->samples; i++ ) out[i/bin_x] += in[i];
+  }
+}
 
-   double result = gsl_spline_eval(spline, x, acc);
-   result = result * match[(int)x-360] * power[(int)x-360];
 
-   return result;
+/* Flag the samples of a BIL scanline that are saturated in any band or that hold no
+   data in any band, such as zero padded margins. Whole band rows are compared at a
+   time so that the loops vectorize
+*/
+void flag_bil( hyspex_header *header, unsigned short *scanline, unsigned char *saturated, unsigned char *data )
+{
+  unsigned int i, k;
+
+  memset( saturated, 0, header->samples );
+  memset( data, 0, header->samples );
+
+  for( k=0; k<header->bands; k++ ){
+    unsigned short *in = scanline + (size_t)k * header->samples;
+    for( i=0; i<header->samples; i++ ){
+      saturated[i] |= ( in[i] == 65535 );
+      data[i] |= ( in[i] != 0 );
+    }
+  }
+}
+
+
+/* Render output line j: load and bin the scanlines it covers and calculate CIE XYZ
+   for each output pixel under each of our stacked illuminants. XYZ receives a whole
+   line for each illuminant in turn. Columns with their own weights are binned only
+   across scanlines, rendered individually and their XYZ values averaged, which is
+   equivalent as rendering is linear. Binned spectra therefore need room for a full
+   scanline. If alpha is given, it receives the fraction of valid input pixels in
+   each output pixel, and if flagged is given, the counts of saturated and empty
+   input pixels are added to it. Buffers are passed in so that several lines can be
+   rendered concurrently. Returns 1 if a scanline cannot be read in full
+*/
+int render_line( FILE *in, hyspex_header *header, unsigned int j, int bin_x, int bin_y,
+		  unsigned short *scanline_spectrum, double *binned_spectrum, double *spectrum,
+		  render_weights *weights, float *XYZ, float *alpha, unsigned long long *flagged )
+{
+  unsigned int output_width = (header->samples + bin_x - 1) / bin_x;
+  int step = weights->group ? 1 : bin_x;
+  unsigned int width = (header->samples + step - 1) / step;
+  unsigned int i, k, n;
+  float stacked[weights->stride], total[weights->stride];
+  unsigned char saturated[header->samples], data[header->samples];
+  unsigned int valid[output_width];
+  unsigned long long counts[2] = { 0, 0 };
+
+  /* Load the block of scanlines covered by this output line in BIL (Band Interleaved Line)
+     format and sum them into our binned spectra
+   */
+  int first_line = j * bin_y;
+  int lines = ( first_line + bin_y > header->scanlines ) ? header->scanlines - first_line : bin_y;
+
+  memset( binned_spectrum, 0, width * sizeof(double) * header->bands );
+  memset( valid, 0, output_width * sizeof(unsigned int) );
+  for( n=0; n<(unsigned int)lines; n++ ){
+    if( load_hyspex_bil( in, header, scanline_spectrum, first_line + n ) != (size_t)header->samples*header->bands ){
+      fprintf( stderr, "Unable to read scanline %d\n", first_line + n );
+      return 1;
+    }
+    accumulate_bil( header, scanline_spectrum, binned_spectrum, step );
+
+    /* Flag invalid pixels while the scanline is still in cache
+     */
+    if( alpha || flagged ){
+      flag_bil( header, scanline_spectrum, saturated, data );
+      for( i=0; i<header->samples; i++ ){
+	counts[0] += saturated[i];
+	counts[1] += !data[i];
+	valid[i/bin_x] += !saturated[i] && data[i];
+      }
+    }
+  }
+
+  if( flagged ){
+#pragma omp atomic
+    flagged[0] += counts[0];
+#pragma omp atomic
+    flagged[1] += counts[1];
+  }
+
+  for( i=0; i<output_width; i++ ){
+
+    /* Number of input pixels averaged into this output pixel and the number of
+       those which are rendered separately
+     */
+    int columns = ( (i+1) * bin_x > header->samples ) ? header->samples - i*bin_x : bin_x;
+    int parts = ( step == 1 ) ? columns : 1;
+    double count = (double)( columns / parts * lines );
+    int m;
+
+    for( n=0; n<weights->stride; n++ ) total[n] = 0.0f;
+
+    for( m=0; m<parts; m++ ){
+
+      unsigned int x = ( step == 1 ) ? i*bin_x + m : i;
+
+      /* Extract the averaged spectral values for pixel i, j
+       */
+      for( k=0; k<header->bands; k++ ){
+	n = x + width*k;
+	spectrum[k] = binned_spectrum[n] / count;
+	if( header->bpp == 2 ) spectrum[k] = spectrum[k] / 65535.0;
+      }
+
+      /* Calculate CIE XYZ for this pixel
+       */
+      apply_weights( weights, ( step == 1 ) ? x : i*bin_x, spectrum, stacked );
+      for( n=0; n<weights->stride; n++ ) total[n] += stacked[n] / parts;
+    }
+
+    for( n=0; n<weights->sets; n++ ){
+      float *xyz = XYZ + ( (size_t)n * output_width + i ) * 3;
+      xyz[0] = total[n*3];
+      xyz[1] = total[n*3 + 1];
+      xyz[2] = total[n*3 + 2];
+    }
+
+    if( alpha ) alpha[i] = (float) valid[i] / (float)( columns * lines );
+  }
+
+  return 0;
+}
+
+
+
+/* Output image rendered in the same pass as all the others. Outputs under the same
+   illuminant share a set of stacked weights
+ */
+typedef struct {
+  char *filename;
+  output_format format;
+  unsigned int set;                   /* Index of our illuminant within the stacked weights */
+  output_writer *writer;
+  resizer *resampler;                 /* Resampler or NULL if not resizing */
+  float *resized;                     /* Resampled XYZ line */
+  resizer *alpha_resampler;           /* Resampler for our alpha channel or NULL */
+  float *resized_alpha;               /* Resampled alpha line */
+  void *color;                        /* Encoded output line */
+} target;
+
+
+
+/* Parse an additional output given as a file name followed by any comma separated
+   settings which differ from our main output: t=illuminant, s=colorspace, b=bits,
+   m=compression or format=type. Returns 1 if invalid
+*/
+int parse_target( const char *spec, output_format *defaults, target *t )
+{
+  char *setting;
+  short compression = defaults->compression;
+  int bits = defaults->bits_per_sample;
+  int half_float = defaults->half_float;
+
+  memset( t, 0, sizeof(target) );
+  t->format = *defaults;
+  t->format.type = -1;
+  t->filename = strdup( spec );
+  strtok( t->filename, "," );
+
+  while( ( setting = strtok( NULL, "," ) ) ){
+
+    char *value = strchr( setting, '=' );
+    if( !value ) return 1;
+    *value++ = '\0';
+
+    if( strcmp( setting, "t" ) == 0 || strcmp( setting, "temperature" ) == 0 ){
+      t->format.illuminant = value;
+    }
+    else if( strcmp( setting, "s" ) == 0 || strcmp( setting, "colorspace" ) == 0 ){
+      parse_colorspace( value, &t->format.colorspace, &t->format.icc_profile );
+    }
+    else if( strcmp( setting, "b" ) == 0 || strcmp( setting, "bits" ) == 0 ){
+      if( parse_bits( value, &bits, &half_float ) != 0 ) return 1;
+    }
+    else if( strcmp( setting, "m" ) == 0 || strcmp( setting, "compression" ) == 0 ){
+      if( parse_compression( value, &compression ) != 0 ) return 1;
+    }
+    else if( strcmp( setting, "format" ) == 0 ){
+      if( ( t->format.type = parse_output_type( value ) ) < 0 ) return 1;
+    }
+    else return 1;
+  }
+
+  t->format.bits_per_sample = bits;
+  t->format.half_float = half_float;
+  t->format.compression = compression;
+
+  return ( t->filename[0] == '\0' );
+}
+
+
+
+/* Set the white point of an output to that of its illuminant within our stacked
+   weights, together with the chromatic adaptation needed for RGB output
+*/
+void set_white_point( output_format *format, render_weights *weights, unsigned int set )
+{
+  memcpy( format->white, &weights->white[3*set], sizeof(format->white) );
+  bradford_adaptation( format->white, weights->reference, format->adaptation );
 }
 
 
+
+/* Pass a rendered line of XYZ values and any alpha through an output's resamplers,
+   if it has them, then encode and write each line produced. Returns 1 on a write
+   error
+*/
+int write_target( target *t, float *XYZ, float *alpha )
+{
+  float *line = XYZ, *mask = alpha;
+  int ready = 1;
+
+  if( t->resampler ){
+    resize_push( t->resampler, XYZ );
+    ready = resize_pull( t->resampler, t->resized );
+    line = t->resized;
+    if( t->alpha_resampler ){
+      resize_push( t->alpha_resampler, alpha );
+      resize_pull( t->alpha_resampler, t->resized_alpha );
+      mask = t->resized_alpha;
+    }
+  }
+
+  while( ready ){
+
+    /* Convert to our output color space and bit depth
+     */
+    encode_colors( &t->format, line, mask, t->color, t->format.width );
+
+    /* Write out a whole scanline
+     */
+    if( write_output_line( t->writer, t->color ) != 0 ) return 1;
+
+    ready = t->resampler ? resize_pull( t->resampler, t->resized ) : 0;
+    if( ready && t->alpha_resampler ) resize_pull( t->alpha_resampler, t->resized_alpha );
+  }
+
+  return 0;
+}
+
+
+
+/* Render a metamerism map in a single pass: the color difference of each pixel
+   between the first of our illuminants and each of the others, written as one
+   floating point sample per illuminant compared. Summary statistics are printed
+   once the map is complete
+*/
+int metamerism_map( FILE *in, hyspex_header *header, const char **illuminants, unsigned int count,
+		    render_options *options, int formula, const char *filename, output_format *format, int bin_x, int bin_y,
+		    int verbose )
+{
+  unsigned int output_width = (header->samples + bin_x - 1) / bin_x;
+  unsigned int output_height = (header->scanlines + bin_y - 1) / bin_y;
+  unsigned short *scanline_spectrum = NULL;
+  double *binned_spectrum = NULL;
+  double *spectrum = NULL;
+  float *XYZ = NULL, *map = NULL;
+  render_weights weights;
+  metamerism m;
+  output_writer *out;
+  unsigned int j;
+  int status = 0;
+
+  if( format->compression == COMPRESSION_JPEG ){
+    fprintf( stderr, "JPEG compression is not available for metamerism maps\n" );
+    return 1;
+  }
+
+  if( create_weights( header, illuminants, count, options, &weights ) != 0 ) return 1;
+  if( create_metamerism( &m, &weights, formula, output_width ) != 0 ){
+    free_weights( &weights );
+    return 1;
+  }
+
+  /* Our map has a floating point sample for each illuminant compared
+   */
+  format->samples = count - 1;
+  format->bits_per_sample = 32;
+  format->half_float = 0;
+  format->colorspace = PHOTOMETRIC_MINISBLACK;
+  format->icc_profile = 0;
+
+  if( ! ( out = open_output( filename, format ) ) ){
+    fprintf( stderr, "Unable to open output image file: '%s'\n", filename );
+    free_metamerism( &m );
+    free_weights( &weights );
+    return 1;
+  }
+
+  scanline_spectrum = malloc( header->samples * sizeof(unsigned short) * header->bands );
+  binned_spectrum = malloc( header->samples * sizeof(double) * header->bands );
+  spectrum = malloc( sizeof(double) * header->bands );
+  XYZ = malloc( sizeof(float) * output_width * 3 * count );
+  map = malloc( output_pixel_size( format ) * output_width );
+
+  for( j=0; j<output_height; j++ ){
+
+    if( render_line( in, header, j, bin_x, bin_y, scanline_spectrum, binned_spectrum, spectrum, &weights, XYZ,
+		     NULL, NULL ) != 0 ){
+      status = 1;
+      break;
+    }
+    metamerism_line( &m, XYZ, map );
+
+    if( write_output_line( out, map ) != 0 ){
+      fprintf( stderr, "TIFF write error at scanline %d\n", j );
+      status = 1;
+      break;
+    }
+
+    if( verbose ){
+      printf( "Processing: %3d\%%\r", (int)(j*100.0/output_height) );
+      fflush( stdout );
+    }
+  }
+
+  if( close_output( out ) != 0 ){
+    fprintf( stderr, "TIFF write error while closing output image\n" );
+    status = 1;
+  }
+
+  /* Our statistics would corrupt a map streamed to standard output
+   */
+  if( status == 0 ) print_metamerism( &m, illuminants, ( strcmp( filename, "-" ) == 0 ) ? stderr : stdout );
+
+  free( scanline_spectrum );
+  free( binned_spectrum );
+  free( spectrum );
+  free( XYZ );
+  free( map );
+  free_metamerism( &m );
+  free_weights( &weights );
+
+  return status;
+}
+
+
+
 int main( int argc, char *argv[] )
 {
   int c;
   int digit_optind = 0;
-  int i, n, j, k;
+  int i, n, j;
 
   int width = 0;
   int height = 0;
   int bands = 0;
   double *wavelengths = NULL;
+  int wavelength_count = 0;
 
   int verbose = 0;
   FILE *in = NULL;
-  TIFF *out = NULL;
+  char *input_file = NULL;
+  char *output_file = NULL;
+  char *probe_file = NULL;
+  char *manifest_file = NULL;
+
+  /* Additional outputs rendered in the same pass as our main output
+   */
+  char **extra_outputs = NULL;
+  int extra_count = 0;
+
+  /* Illuminants for a metamerism map, the first being our reference, and the color
+     difference formula (default: CIEDE2000)
+   */
+  const char **metamerism_illuminants = NULL;
+  int metamerism_count = 0;
+  int delta_e = DELTA_E_2000;
 
   /* Output color space (default: sRGB)
    */
@@ -187,18 +984,89 @@ int main( int argc, char *argv[] )
    */
   unsigned int icc_profile = 1;
 
-  /* Rendered color temperature (default: D65, 6504K)
+  /* Rendering illuminant (default: D65)
+   */
+  const char *illuminant = "D65";
+
+  /* Settings for our rendering weights: standard observer, spectral smoothing, band
+     responses, spectral smile, flat-field references and bad bands
+   */
+  render_options options = { OBSERVER_2, SMOOTH_NONE, 0, 0, 0.0, RESPONSE_POINT, NULL, NULL, NULL, NULL, 0, NULL, NULL, NULL, NULL, NULL };
+
+  /* Band widths given on the command line
+   */
+  double *fwhm = NULL;
+  int fwhm_count = 0;
+
+  /* Smile polynomial coefficients given on the command line
    */
-  int temperature = 6504;
+  double *smile = NULL;
+
+  /* White and dark references for flat-field correction
+   */
+  const char *white_spec = NULL, *dark_spec = NULL;
+  reference_source white_source, dark_source;
+
+  /* Bad bands, columns and detector pixels
+   */
+  const char *mask_file = NULL;
+  pixel_mask mask;
+
+  /* Add an alpha channel flagging saturated and empty pixels
+   */
+  int alpha = 0;
 
   /* Output bits per channel (default: 8)
    */
   int bpc = 0;
+  int half_float = 0;
 
   /* Output compression
    */
   short compression = COMPRESSION_NONE;
 
+  /* Output tile size (default: 0 for a stripped image)
+   */
+  unsigned int tile_size = 0;
+
+  /* Strip height, compression predictor and deflate level (default: libtiff defaults)
+   */
+  unsigned int rows_per_strip = 0;
+  uint16_t predictor = PREDICTOR_NONE;
+  int deflate_level = -1;
+
+  /* JPEG quality and chroma subsampling (default: quality 75 with 4:2:0 subsampling)
+   */
+  int jpeg_quality = 75;
+  int jpeg_subsampling = 2;
+
+  /* BigTIFF output: 1 to force, 0 to disable, -1 to use when required (default)
+   */
+  int bigtiff = -1;
+
+  /* Multi-resolution pyramid output
+   */
+  int pyramid = 0;
+
+  /* Output resize request and resampling filter (default: no resizing)
+   */
+  char *resize = NULL;
+  int resize_filter = RESIZE_LANCZOS;
+
+  /* Output file type (default: -1 to choose from the output file name)
+   */
+  int output_type = -1;
+
+  /* Clockwise output rotation in degrees and left to right mirroring (default: none)
+   */
+  int rotate = 0;
+  int flip = 0;
+
+  /* Spatial binning factors for samples and scanlines (default: no binning)
+   */
+  int bin_x = 1;
+  int bin_y = 1;
+
   /* Parse our options
    */
   while( 1 ) {
@@ -209,6 +1077,18 @@ int main( int argc, char *argv[] )
       {"input", 1, 0, 'i'},
       {"output", 1, 0, 'o'},
       {"temperature", 1, 0, 't'},
+      {"power", 1, 0, 'p'},
+      {"observer", 1, 0, OPT_OBSERVER},
+      {"smooth", 1, 0, OPT_SMOOTH},
+      {"srf", 1, 0, OPT_SRF},
+      {"fwhm", 1, 0, OPT_FWHM},
+      {"smile", 1, 0, OPT_SMILE},
+      {"white-ref", 1, 0, OPT_WHITE_REF},
+      {"dark-ref", 1, 0, OPT_DARK_REF},
+      {"mask", 1, 0, OPT_MASK},
+      {"alpha", 0, 0, OPT_ALPHA},
+      {"camera", 1, 0, OPT_CAMERA},
+      {"camera-correction", 1, 0, OPT_CORRECTION},
       {"colorspace", 1, 0, 's'},
       {"bits", 1, 0, 'b'},
       {"width", 1, 0, 'x'},
@@ -216,12 +1096,31 @@ int main( int argc, char *argv[] )
       {"channels", 1, 0, 'c'},
       {"wavelengths", 1, 0, 'w'},
       {"compression", 1, 0, 'm'},
+      {"tile", 1, 0, 'T'},
+      {"strip-rows", 1, 0, OPT_STRIP_ROWS},
+      {"predictor", 1, 0, OPT_PREDICTOR},
+      {"deflate-level", 1, 0, OPT_DEFLATE_LEVEL},
+      {"jpeg-quality", 1, 0, OPT_JPEG_QUALITY},
+      {"jpeg-subsampling", 1, 0, OPT_JPEG_SUBSAMPLING},
+      {"bigtiff", 1, 0, OPT_BIGTIFF},
+      {"pyramid", 0, 0, OPT_PYRAMID},
+      {"resize", 1, 0, OPT_RESIZE},
+      {"resize-filter", 1, 0, OPT_RESIZE_FILTER},
+      {"format", 1, 0, OPT_FORMAT},
+      {"rotate", 1, 0, OPT_ROTATE},
+      {"flip", 0, 0, OPT_FLIP},
+      {"add-output", 1, 0, OPT_ADD_OUTPUT},
+      {"metamerism", 1, 0, OPT_METAMERISM},
+      {"delta-e", 1, 0, OPT_DELTA_E},
+      {"bin", 1, 0, 'n'},
+      {"probe", 1, 0, 'P'},
+      {"manifest", 1, 0, 'M'},
       {"help", 0, 0, 'h'},
       {"verbose", 0, 0, 'v'},
       {0, 0, 0, 0}
     };
 
-    c = getopt_long( argc, argv, "i:o:t:s:b:x:y:c:w:m:vh", long_options, &option_index );
+    c = getopt_long( argc, argv, "i:o:t:p:s:b:x:y:c:w:m:T:n:P:M:vh", long_options, &option_index );
 
     if( c == -1 ){
       break;
@@ -234,58 +1133,54 @@ int main( int argc, char *argv[] )
        */
       if( ! ( in = fopen( optarg, "rb" ) ) ){
 	help();
-	printf( "Unable to open input image file: '%s'\n\n", optarg );
+	fprintf( stderr, "Unable to open input image file: '%s'\n\n", optarg );
 	exit( 1 );
       }
+      input_file = optarg;
       break;
 
     case 'o':
-      /* Out output image
+      /* Out output image - opened once we know what we are writing
        */
-      if( ! ( out = TIFFOpen( optarg, "w" ) ) ){
-	help();
-	printf( "Unable to open output image file: '%s'\n\n", optarg );
-	exit( 1 );
-      }
+      output_file = optarg;
+      break;
+
+    case 'P':
+      /* List of pixels to sample
+       */
+      probe_file = optarg;
+      break;
+
+    case 'M':
+      /* Manifest of regions to extract
+       */
+      manifest_file = optarg;
       break;
 
     case 's':
       /* Output color space - sRGB by default
        */
-      if( strncasecmp( optarg, "CIELAB", 64 ) == 0 ){
-	colorspace = PHOTOMETRIC_CIELAB;
-	icc_profile = 0;
-      }
-      else if( strncasecmp( optarg, "AdobeRGB", 64 ) == 0 ){
-	colorspace = PHOTOMETRIC_RGB;
-	icc_profile = 2;
-      }
-      else{
-	colorspace = PHOTOMETRIC_RGB;
-	icc_profile = 1;
-      }
-
+      parse_colorspace( optarg, &colorspace, &icc_profile );
       break;
 
     case 't':
-      /* Requested color temperature
+      /* Requested illuminant or color temperature
+       */
+      illuminant = optarg;
+      break;
+
+    case 'p':
+      /* Illuminant power spectrum file
        */
-      if( strcmp( optarg, "D93" ) == 0 ) temperature = 9300;
-      else if( strcmp( optarg, "D75" ) == 0 ) temperature = 7500;
-      else if( strcmp( optarg, "D65" ) == 0 ) temperature = 6504;
-      else if( strcmp( optarg, "D50" ) == 0 ) temperature = 5000;
-      else if( strcmp( optarg, "A" ) == 0 ) temperature = -1;
-      else temperature = atoi( optarg );
+      illuminant = optarg;
       break;
 
     case 'b':
       /* Output bits per channel
        */
-      n = atoi( optarg );
-      if( n == 8 || n == 16 || n == 32 ){
-	bpc = n;
+      if( parse_bits( optarg, &bpc, &half_float ) != 0 ){
+	fprintf( stderr, "Unsupported bit depth '%s': defaulting to 8\n", optarg );
       }
-      else printf( "Unsupported bit depth '%s': defaulting to 8\n", optarg );
       break;
 
     case 'x':
@@ -326,20 +1221,236 @@ int main( int argc, char *argv[] )
       /* Tokenize our string and load into an array
        */
       char* token = strtok(s, ",");
-      wavelengths = malloc( sizeof(double)*bands );
-      int n = 0;
+      wavelength_count = 0;
       while( token ){
-	wavelengths[n++] = atof( token );
+	wavelengths = realloc( wavelengths, sizeof(double)*(wavelength_count+1) );
+	wavelengths[wavelength_count++] = atof( token );
 	token = strtok(NULL, ",");
       }
+      free( u );
       break;
 
     case 'm':
       /* Output compression
        */
-      if( strcasecmp( optarg, "deflate" ) == 0 ) compression = COMPRESSION_DEFLATE;
-      if( strcasecmp( optarg, "lzw" ) == 0 ) compression = COMPRESSION_LZW;
-      if( strcasecmp( optarg, "jpeg" ) == 0 ) compression = COMPRESSION_JPEG;
+      parse_compression( optarg, &compression );
+      break;
+
+    case 'T':
+      /* Tile size: TIFF requires a multiple of 16
+       */
+      tile_size = atoi( optarg );
+      if( tile_size % 16 ){
+	tile_size = ( tile_size/16 + 1 ) * 16;
+	fprintf( stderr, "Tile size must be a multiple of 16: using %d\n", tile_size );
+      }
+      break;
+
+    case OPT_STRIP_ROWS:
+      /* Rows per strip
+       */
+      rows_per_strip = atoi( optarg );
+      break;
+
+    case OPT_PREDICTOR:
+      /* Compression predictor
+       */
+      if( strcasecmp( optarg, "horizontal" ) == 0 ) predictor = PREDICTOR_HORIZONTAL;
+      else if( strcasecmp( optarg, "float" ) == 0 ) predictor = PREDICTOR_FLOATINGPOINT;
+      else predictor = PREDICTOR_NONE;
+      break;
+
+    case OPT_DEFLATE_LEVEL:
+      /* zlib compression level
+       */
+      deflate_level = atoi( optarg );
+      if( deflate_level < 1 || deflate_level > 9 ){
+	fprintf( stderr, "Unsupported deflate level '%s': using default\n", optarg );
+	deflate_level = -1;
+      }
+      break;
+
+    case OPT_JPEG_QUALITY:
+      jpeg_quality = atoi( optarg );
+      if( jpeg_quality < 1 || jpeg_quality > 100 ){
+	help();
+	fprintf( stderr, "JPEG quality must be between 1 and 100\n\n" );
+	exit( 1 );
+      }
+      break;
+
+    case OPT_JPEG_SUBSAMPLING:
+      jpeg_subsampling = ( strcmp( optarg, "444" ) == 0 ) ? 1 : 2;
+      break;
+
+    case OPT_BIGTIFF:
+      /* BigTIFF output
+       */
+      if( strcasecmp( optarg, "yes" ) == 0 ) bigtiff = 1;
+      else if( strcasecmp( optarg, "no" ) == 0 ) bigtiff = 0;
+      else bigtiff = -1;
+      break;
+
+    case OPT_PYRAMID:
+      pyramid = 1;
+      break;
+
+    case OPT_RESIZE:
+      resize = optarg;
+      break;
+
+    case OPT_RESIZE_FILTER:
+      if( strcasecmp( optarg, "box" ) == 0 ) resize_filter = RESIZE_BOX;
+      else if( strcasecmp( optarg, "bicubic" ) == 0 ) resize_filter = RESIZE_BICUBIC;
+      else resize_filter = RESIZE_LANCZOS;
+      break;
+
+    case OPT_FORMAT:
+      if( ( output_type = parse_output_type( optarg ) ) < 0 ){
+	help();
+	fprintf( stderr, "Unknown output format: '%s'\n\n", optarg );
+	exit( 1 );
+      }
+      break;
+
+    case OPT_ROTATE:
+      rotate = atoi( optarg );
+      if( rotate % 90 != 0 ){
+	help();
+	fprintf( stderr, "Rotation must be 90, 180 or 270 degrees\n\n" );
+	exit( 1 );
+      }
+      rotate = ( ( rotate % 360 ) + 360 ) % 360;
+      break;
+
+    case OPT_FLIP:
+      flip = 1;
+      break;
+
+    case OPT_ADD_OUTPUT:
+      extra_outputs = realloc( extra_outputs, sizeof(char*) * (extra_count+1) );
+      extra_outputs[extra_count++] = optarg;
+      break;
+
+    case OPT_METAMERISM:
+      /* Comma separated list of illuminants
+       */
+      ;
+      char *name;
+      metamerism_count = 0;
+      for( name = strtok( optarg, "," ); name; name = strtok( NULL, "," ) ){
+	metamerism_illuminants = realloc( metamerism_illuminants, sizeof(char*) * (metamerism_count+1) );
+	metamerism_illuminants[metamerism_count++] = name;
+      }
+      if( metamerism_count < 2 ){
+	help();
+	fprintf( stderr, "A metamerism map needs at least two illuminants (eg: D65,A)\n\n" );
+	exit( 1 );
+      }
+      break;
+
+    case OPT_OBSERVER:
+      options.observer = atoi( optarg );
+      if( options.observer != OBSERVER_2 && options.observer != OBSERVER_10 ){
+	fprintf( stderr, "Unsupported observer '%s': using the CIE 1931 2 degree observer\n", optarg );
+	options.observer = OBSERVER_2;
+      }
+      break;
+
+    case OPT_SMOOTH:
+      if( parse_smoothing( optarg, &options ) != 0 ){
+	help();
+	fprintf( stderr, "Invalid smoothing filter: '%s'\n\n", optarg );
+	exit( 1 );
+      }
+      break;
+
+    case OPT_SRF:
+      if( strcasecmp( optarg, "gaussian" ) == 0 ) options.response = RESPONSE_GAUSSIAN;
+      else{
+	options.response = RESPONSE_TABULATED;
+	options.response_file = optarg;
+      }
+      break;
+
+    case OPT_FWHM:
+      ;
+      char *width;
+      fwhm_count = 0;
+      for( width = strtok( optarg, "," ); width; width = strtok( NULL, "," ) ){
+	fwhm = realloc( fwhm, sizeof(double) * (fwhm_count+1) );
+	fwhm[fwhm_count] = atof( width );
+	if( fwhm[fwhm_count++] <= 0.0 ){
+	  help();
+	  fprintf( stderr, "Invalid band width: '%s'\n\n", width );
+	  exit( 1 );
+	}
+      }
+      if( options.response == RESPONSE_POINT ) options.response = RESPONSE_GAUSSIAN;
+      break;
+
+    case OPT_WHITE_REF:
+    case OPT_DARK_REF:
+      if( parse_reference( optarg, ( c == OPT_WHITE_REF ) ? &white_source : &dark_source ) != 0 ){
+	help();
+	fprintf( stderr, "Invalid reference: '%s'\n\n", optarg );
+	exit( 1 );
+      }
+      if( c == OPT_WHITE_REF ) white_spec = optarg;
+      else dark_spec = optarg;
+      break;
+
+    case OPT_MASK:
+      mask_file = optarg;
+      break;
+
+    case OPT_ALPHA:
+      alpha = 1;
+      break;
+
+    case OPT_CAMERA:
+      options.camera_file = optarg;
+      break;
+
+    case OPT_CORRECTION:
+      options.correction_file = optarg;
+      break;
+
+    case OPT_SMILE:
+      if( strncmp( optarg, "poly:", 5 ) == 0 ){
+	char *coefficient, *end;
+	options.smile_file = NULL;
+	options.smile_terms = 0;
+	for( coefficient = strtok( optarg + 5, "," ); coefficient; coefficient = strtok( NULL, "," ) ){
+	  smile = realloc( smile, sizeof(double) * (options.smile_terms+1) );
+	  smile[options.smile_terms++] = strtod( coefficient, &end );
+	  if( end == coefficient ){
+	    help();
+	    fprintf( stderr, "Invalid smile coefficient: '%s'\n\n", coefficient );
+	    exit( 1 );
+	  }
+	}
+	options.smile = smile;
+      }
+      else{
+	options.smile_file = optarg;
+	options.smile_terms = 0;
+      }
+      break;
+
+    case OPT_DELTA_E:
+      delta_e = ( atoi( optarg ) == 76 ) ? DELTA_E_76 : DELTA_E_2000;
+      break;
+
+    case 'n':
+      /* Binning: NxM or a single factor for both directions
+       */
+      i = sscanf( optarg, "%dx%d", &bin_x, &bin_y );
+      if( i == 1 ) bin_y = bin_x;
+      if( i < 1 || bin_x < 1 || bin_y < 1 ){
+	fprintf( stderr, "Invalid binning '%s': disabling binning\n", optarg );
+	bin_x = bin_y = 1;
+      }
       break;
 
     case 'h':
@@ -359,13 +1470,18 @@ int main( int argc, char *argv[] )
   }
 
 
+  /* Our messages would corrupt an image streamed to standard output
+   */
+  if( output_file && strcmp( output_file, "-" ) == 0 && !probe_file ) verbose = 0;
+
+
   /* Make sure we have properly intialized some stuff
    */
-  if( !in || !out ){
+  if( !in || ( !output_file && !probe_file && !manifest_file ) ){
     help();
-    if( !in ) printf( "No input image specified\n" );
-    if( !out ) printf( "No output image specified\n" );
-    printf( "\n" );
+    if( !in ) fprintf( stderr, "No input image specified\n" );
+    if( !output_file ) fprintf( stderr, "No output image specified\n" );
+    fprintf( stderr, "\n" );
     exit( 1 );
   }
 
@@ -374,8 +1490,23 @@ int main( int argc, char *argv[] )
   /* Extract info from hyspex header
    */
   hyspex_header header;
-
-  if( width==0 && height==0 && bands==0 ){
+  memset( &header, 0, sizeof(hyspex_header) );
+
+  if( is_tiff( in ) ){
+    if( open_spectral_tiff( input_file, &header ) != 0 ) exit( 1 );
+    if( wavelengths ){
+      if( wavelength_count != (int) header.bands ){
+	fprintf( stderr, "Number of wavelengths (%d) does not match the %u bands of the TIFF input image\n",
+		 wavelength_count, header.bands );
+	exit( 1 );
+      }
+      free( header.wavelengths );
+      header.wavelengths = wavelengths;
+    }
+    if( !header.wavelengths ) exit( 1 );
+    width = height = bands = 0;
+  }
+  else if( width==0 && height==0 && bands==0 ){
     parse_hyspex_header( in, &header );
   }
 
@@ -447,265 +1578,417 @@ int main( int argc, char *argv[] )
     header.bpp = 2;
   }
 
+  /* Raw and Hyspex cubes can have the width of each band in an ENVI .hdr sidecar
+   */
+  if( !header.source ){
+    for( n=0; n<2 && !header.fwhm; n++ ){
+      char *text = load_envi_sidecar( input_file, n );
+      if( text ) parse_envi_fwhm( text, &header );
+      free( text );
+    }
+  }
+
 
   if( verbose ){
-    printf( "Hyspex header size %d bytes\n", header.size );
+    if( header.source ) printf( "Spectral TIFF input\n" );
+    else printf( "Hyspex header size %d bytes\n", header.size );
     printf( "Hyperspectral data cube: %dx%d pixels, %d bands\n", header.samples, header.scanlines, header.bands );
     unsigned char* space = "CIE L*a*b*";
-    if( icc_profile == 1 ) space = "sRGB";
+    if( colorspace == COLORSPACE_XYZ ) space = "CIE XYZ";
+    else if( icc_profile == 1 ) space = "sRGB";
     else if( icc_profile == 2 ) space = "AdobeRGB";
     printf( "Output color space: %s\n", space );
-    printf( "Output color temperature: %d Kelvin\n", temperature );
+    printf( "Output illuminant: %s\n", illuminant );
+    printf( "Standard observer: CIE %s\n", ( options.observer == OBSERVER_10 ) ? "1964 10 degree" : "1931 2 degree" );
+    if( options.camera_file ) printf( "Camera sensitivities: %s\n", options.camera_file );
+    if( options.correction_file ) printf( "Camera color correction: %s\n", options.correction_file );
+    if( options.smooth == SMOOTH_SAVITZKY_GOLAY ){
+      printf( "Spectral smoothing: Savitzky-Golay over %u bands of order %u\n", options.smooth_window, options.smooth_order );
+    }
+    else if( options.smooth == SMOOTH_GAUSSIAN ){
+      printf( "Spectral smoothing: Gaussian of %g nm standard deviation\n", options.smooth_sigma );
+    }
+    if( options.response == RESPONSE_GAUSSIAN ) printf( "Band responses: Gaussian\n" );
+    else if( options.response == RESPONSE_TABULATED ) printf( "Band responses: %s\n", options.response_file );
+    if( options.smile_file ) printf( "Spectral smile: %s\n", options.smile_file );
+    else if( options.smile_terms ) printf( "Spectral smile: polynomial of order %u\n", options.smile_terms - 1 );
+    if( white_spec ) printf( "White reference: %s\n", white_spec );
+    if( dark_spec ) printf( "Dark reference: %s\n", dark_spec );
+    if( bin_x > 1 || bin_y > 1 ) printf( "Binning: %dx%d pixels\n", bin_x, bin_y );
     //    printf( "Output bits per pixel: %d\n", bpc );
   }
 
 
-  unsigned short *scanline_spectrum;
-  scanline_spectrum = malloc( header.samples * sizeof(unsigned short) * header.bands );
-
-  double spectrum[320];
-
-  /* Load up our illuminant power spectrum
+  /* Gaussian band responses take their widths from the command line, where a single
+     width applies to every band, or from the input header
    */
-  double power_spectrum[531][2];
-  for( k=300; k<=830; k++ ){
-
-    power_spectrum[k-300][0] = k;
-
-    if( temperature == -1 ) power_spectrum[k-300][1] = CIE_A[k-300][1];
-    else if( temperature == 6504 ) power_spectrum[k-300][1] = D65[k-300][1];
-    else power_spectrum[k-300][1] = calculate_power_spectrum( temperature, k );
+  if( options.response == RESPONSE_GAUSSIAN ){
+    if( fwhm_count == 1 ){
+      fwhm = realloc( fwhm, sizeof(double) * header.bands );
+      for( n=1; n<(int)header.bands; n++ ) fwhm[n] = fwhm[0];
+      fwhm_count = header.bands;
+    }
+    if( fwhm_count == (int)header.bands ) options.fwhm = fwhm;
+    else if( fwhm_count == 0 && header.fwhm ) options.fwhm = header.fwhm;
+    else{
+      fprintf( stderr, "Gaussian band responses need a width for each of the %d bands: use --fwhm\n", header.bands );
+      exit( 1 );
+    }
   }
 
 
-  int firstwav = ceil( header.wavelengths[0] );
-
-  int tr = firstwav - cie_color_match[0][0];
-  int te = firstwav - power_spectrum[0][0];
-
-
-  /* Calculate CIE normalization
+  /* Bad columns and detector pixels are repaired as each scanline is loaded and bad
+     bands are left out of our weights
    */
-  double norm = 0.0;
-  for( k=0; k<=830-firstwav; k++ ){
-    norm += cie_color_match[tr+k][2] * power_spectrum[te+k][1];
+  if( mask_file ){
+    if( load_mask( mask_file, &header, &mask ) != 0 ) exit( 1 );
+    header.mask = &mask;
+    options.bad_bands = mask.bad_band;
+    if( verbose ){
+      for( n=0, i=0; n<(int)header.bands; n++ ) i += mask.bad_band[n];
+      printf( "Mask: %d bad bands and %u bad detector pixels\n", i, mask.count );
+    }
   }
-  double power[471];
-  for( k=0; k<471; k++ ){
-    power[k] = power_spectrum[k+60][1];
+
+
+  if( options.correction_file && !options.camera_file ){
+    fprintf( stderr, "A camera color correction needs camera sensitivities: use --camera\n" );
+    exit( 1 );
   }
 
 
-  double X_match[471];
-  for( k=0; k<471; k++ ){
-    X_match[k] = cie_color_match[k][1];
+  /* Average our flat-field references for each column in a pre-pass, reading only
+     the reference scanlines, so that reflectance conversion can be folded into our
+     rendering weights
+   */
+  if( dark_spec && !white_spec ){
+    fprintf( stderr, "A dark reference needs a white reference: use --white-ref\n" );
+    exit( 1 );
   }
-  double Y_match[471];
-  for( k=0; k<471; k++ ){
-    Y_match[k] = cie_color_match[k][2];
+  if( white_spec ){
+    double *white = malloc( sizeof(double) * header.samples * header.bands );
+    if( average_reference( in, &header, &white_source, white ) != 0 ) exit( 1 );
+    options.white_ref = white;
   }
-  double Z_match[471];
-  for( k=0; k<471; k++ ){
-    Z_match[k] = cie_color_match[k][3];
+  if( dark_spec ){
+    double *dark = malloc( sizeof(double) * header.samples * header.bands );
+    if( average_reference( in, &header, &dark_source, dark ) != 0 ) exit( 1 );
+    options.dark_ref = dark;
   }
 
 
+  unsigned short *scanline_spectrum;
+  scanline_spectrum = malloc( header.samples * sizeof(unsigned short) * header.bands );
 
-  /* First define our bits per sample and format
+  /* Size of our output image after binning. Partial blocks at the right and bottom
+     edges are averaged over the pixels they actually contain
    */
-  int bits_per_sample = 8;
-  short sample_format = SAMPLEFORMAT_UINT;
+  unsigned int output_width = (header.samples + bin_x - 1) / bin_x;
+  unsigned int output_height = (header.scanlines + bin_y - 1) / bin_y;
 
-  if( bpc == 32 ){
-    bits_per_sample = 32;
-    sample_format = SAMPLEFORMAT_IEEEFP;
-  }
-  else if( bpc == 16 ){
-    bits_per_sample = 16;
-    sample_format = SAMPLEFORMAT_UINT;
-  }
-  else{
-    bits_per_sample = 8;
-    sample_format = SAMPLEFORMAT_UINT;
-  }
+  /* Binned spectra for one output line, stored band interleaved like the input
+   */
+  double *binned_spectrum = malloc( header.samples * sizeof(double) * header.bands );
 
+  /* Spectrum of a single pixel
+   */
+  double *spectrum = malloc( sizeof(double) * header.bands );
 
-  /* Allocate memory for the color values of a single scan line
+  /* Weights for rendering CIE XYZ from our spectra
    */
-  void *calculated_color = NULL;
+  render_weights weights;
 
-  if( bits_per_sample == 32 ) calculated_color = malloc( sizeof(float)*header.samples*3 );
-  else if( bits_per_sample == 16 ) calculated_color = malloc( sizeof(unsigned short)*header.samples*3 );
-  else calculated_color = malloc( sizeof(unsigned char)*header.samples*3 );
+  /* In probe mode, sample our list of pixels and exit
+   */
+  if( probe_file ){
+    if( create_weights( &header, &illuminant, 1, &options, &weights ) != 0 ) exit( 1 );
+    n = probe_pixels( in, &header, probe_file, output_file, &weights, icc_profile, verbose );
+    free_weights( &weights );
+    free( scanline_spectrum );
+    free( binned_spectrum );
+    free( spectrum );
+    close_spectral_tiff( &header );
+    fclose( in );
+    return n;
+  }
 
 
-  /* Set basic TIFF metadata tags
+
+  /* Define our output image format
+   */
+  output_format format;
+  format.width = output_width;
+  format.height = output_height;
+  format.samples = 3;
+  format.alpha = 0;
+  format.bits_per_sample = ( bpc == 32 || bpc == 16 ) ? bpc : 8;
+  format.half_float = half_float;
+  format.type = output_type;
+  format.colorspace = colorspace;
+  format.icc_profile = icc_profile;
+  format.illuminant = illuminant;
+  format.compression = compression;
+  format.x_resolution = 150.0 / bin_x;     // 150 pixels per cm before binning
+  format.y_resolution = 150.0 / bin_y;
+  format.tile_size = tile_size;
+  format.rows_per_strip = rows_per_strip;
+  format.predictor = predictor;
+  format.deflate_level = deflate_level;
+  format.jpeg_quality = jpeg_quality;
+  format.jpeg_subsampling = jpeg_subsampling;
+  format.bigtiff = bigtiff;
+  format.pyramid = pyramid;
+  format.rotate = rotate;
+  format.flip = flip;
+
+
+  /* Resample our rendered scanlines to the requested size. Resolution is scaled
+     to match so that the physical size of the image is preserved
    */
-  TIFFSetField( out, TIFFTAG_IMAGEWIDTH, header.samples );          // set the width of the image
-  TIFFSetField( out, TIFFTAG_IMAGELENGTH, header.scanlines );       // set the height of the image
-  TIFFSetField( out, TIFFTAG_SAMPLESPERPIXEL, 3 );                  // set number of channels per pixel
-  TIFFSetField( out, TIFFTAG_BITSPERSAMPLE, bits_per_sample );      // set the size of the channels
-  TIFFSetField( out, TIFFTAG_SAMPLEFORMAT, sample_format );         // Floating point precision
-  TIFFSetField( out, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT );    // set the origin of the image.
-  TIFFSetField( out, TIFFTAG_RESOLUTIONUNIT, RESUNIT_CENTIMETER );  // set resolution to cm
-  TIFFSetField( out, TIFFTAG_XRESOLUTION, 150.0 );                  // 150 pixels per cm
-  TIFFSetField( out, TIFFTAG_YRESOLUTION, 150.0 );                  // 150 pixels per cm
-  //  TIFFSetField( out, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize(out,header.scanlines*header.samples) );
-  TIFFSetField( out, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize( out, header.samples*3 ) );
-  TIFFSetField( out, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG );
-  TIFFSetField( out, TIFFTAG_PHOTOMETRIC, colorspace );
-  TIFFSetField( out, TIFFTAG_COMPRESSION, compression );
-  TIFFSetField( out, TIFFTAG_SOFTWARE, "hyper2color" );
-  TIFFSetField( out, TIFFTAG_IMAGEDESCRIPTION, "Color rendering of hyperspectral image cube" );
+  int resizing = 0;
+  if( resize ){
+    if( parse_resize( resize, output_width, output_height, &format.width, &format.height ) != 0 ){
+      help();
+      fprintf( stderr, "Invalid resize: '%s'\n\n", resize );
+      exit( 1 );
+    }
+    format.x_resolution *= (double) format.width / output_width;
+    format.y_resolution *= (double) format.height / output_height;
+    resizing = ( format.width != output_width || format.height != output_height );
+    if( verbose ) printf( "Resizing output to %dx%d pixels\n", format.width, format.height );
+  }
 
-  // TIFFTAG_COLORSPACE is an EXIF field - leave for now
-  //  if( colorspace == PHOTOMETRIC_RGB ) TIFFSetField( out, TIFFTAG_COLORSPACE, 1 );
-  //  else TIFFSetField( out, TIFFTAG_COLORSPACE, 65535 );
 
-  // Set ICC profile if necessary
-  if( icc_profile > 0 ){
-    unsigned char* buffer = NULL;
-    size_t len;
-    if( icc_profile == 1 ){
-      buffer = sRGB_ICC;
-      len = sRGB_ICC_size;
-    }
-    else if( icc_profile == 2 ){
-      buffer = AdobeRGB_ICC;
-      len = AdobeRGB_ICC_size;
+  /* In manifest mode, extract each region to its own image in a single pass and exit
+   */
+  if( manifest_file ){
+    region *regions = NULL;
+    if( create_weights( &header, &illuminant, 1, &options, &weights ) == 0 ){
+      set_white_point( &format, &weights, 0 );
+      n = load_manifest( manifest_file, &header, &format, &regions );
+      if( n >= 0 ){
+	if( verbose ) printf( "Extracting %d regions\n", n );
+	n = extract_regions( in, &header, regions, n, &weights, verbose );
+      }
+      else n = 1;
+      free_weights( &weights );
     }
-    TIFFSetField( out, TIFFTAG_ICCPROFILE, len, buffer );
+    else n = 1;
+    free( regions );
+    free( scanline_spectrum );
+    free( binned_spectrum );
+    free( spectrum );
+    close_spectral_tiff( &header );
+    fclose( in );
+    return n;
   }
 
 
-  // We set the strip size of the file to be size of one row of pixels
-  //  TIFFSetField( out, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize( out, header.samples*3 ) );
+  /* In metamerism mode, map the color differences between our illuminants and exit
+   */
+  if( metamerism_count ){
+    if( resizing ){
+      fprintf( stderr, "Resizing is not available for metamerism maps\n" );
+      n = 1;
+    }
+    else n = metamerism_map( in, &header, metamerism_illuminants, metamerism_count, &options, delta_e,
+			     output_file, &format, bin_x, bin_y, verbose );
+    free( metamerism_illuminants );
+    free( extra_outputs );
+    free( scanline_spectrum );
+    free( binned_spectrum );
+    free( spectrum );
+    close_spectral_tiff( &header );
+    fclose( in );
+    return n;
+  }
 
 
-  /* Set up our integration function
+  /* Rendered outputs can carry an alpha channel after their color samples
    */
-  gsl_function F;
-  F.function = &f;
-  gsl_integration_workspace *w = gsl_integration_workspace_alloc( 2000 );
+  if( alpha ){
+    format.alpha = 1;
+    format.samples = 4;
+  }
 
 
-  /* Loop through our pixels and calculate the CIE XYZ
+  /* Our main output followed by any additional outputs, which take their settings
+     from our main output unless overridden
    */
-  for( j=0; j<header.scanlines; j++ ){
-
-    /* Load an entire line in BIL (Band Interleaved Line) format
-     */
-    load_hyspex_bil( in, &header, scanline_spectrum, j );
+  int target_count = extra_count + 1;
+  target *targets = calloc( target_count, sizeof(target) );
+  targets[0].filename = strdup( output_file );
+  targets[0].format = format;
+  for( n=0; n<extra_count; n++ ){
+    if( parse_target( extra_outputs[n], &format, &targets[n+1] ) != 0 ){
+      help();
+      fprintf( stderr, "Invalid output specification: '%s'\n\n", extra_outputs[n] );
+      exit( 1 );
+    }
+  }
 
-    for( i=0; i<header.samples; i++ ){
 
-      /* Extract the spectral values for pixel i, j
-       */
-      for( k=0; k<header.bands; k++ ){
-	n = i + header.samples*k;
-	if( header.bpp == 2 ) spectrum[k] = (double)scanline_spectrum[n] / 65535.0;
-	else spectrum[k] = (double)scanline_spectrum[n];
-      }
+  /* Stack the weights for each distinct illuminant so that all our outputs are
+     rendered from a single pass through the cube
+   */
+  const char **illuminants = malloc( target_count * sizeof(char*) );
+  unsigned int sets = 0;
+  for( n=0; n<target_count; n++ ){
+    unsigned int set;
+    for( set=0; set<sets && strcmp( illuminants[set], targets[n].format.illuminant ) != 0; set++ );
+    if( set == sets ) illuminants[sets++] = targets[n].format.illuminant;
+    targets[n].set = set;
+  }
+  if( create_weights( &header, illuminants, sets, &options, &weights ) != 0 ) exit( 1 );
+  free( illuminants );
+  if( verbose && weights.group ){
+    printf( "Spectral smile: %u weight sets for %u columns\n", weights.groups, header.samples );
+  }
+  for( n=0; n<target_count; n++ ) set_white_point( &targets[n].format, &weights, targets[n].set );
 
-      /* Interpolate using GSL
-       */
-      gsl_interp_accel *acc = gsl_interp_accel_alloc();
-      gsl_spline *spline = gsl_spline_alloc( gsl_interp_linear, header.bands );
-      gsl_spline_init( spline, header.wavelengths, spectrum, header.bands );
+  if( verbose && target_count > 1 ){
+    printf( "Rendering %d outputs under %u illuminants\n", target_count, sets );
+  }
 
 
-      double X, Y, Z;
-      X = Y = Z = 0.0;
+  /* Open our output images. This may adjust the bit depth to suit the file type
+   */
+  for( n=0; n<target_count; n++ ){
+    target *t = &targets[n];
+    if( ! ( t->writer = open_output( t->filename, &t->format ) ) ){
+      help();
+      fprintf( stderr, "Unable to open output image file: '%s'\n\n", t->filename );
+      exit( 1 );
+    }
+    t->color = malloc( output_pixel_size(&t->format)*t->format.width );
+    if( resizing ){
+      t->resampler = create_resizer( output_width, output_height, t->format.width, t->format.height, resize_filter, 3 );
+      t->resized = malloc( sizeof(float)*t->format.width*3 );
+      if( alpha ){
+	t->alpha_resampler = create_resizer( output_width, output_height, t->format.width, t->format.height, resize_filter, 1 );
+	t->resized_alpha = malloc( sizeof(float)*t->format.width );
+      }
+    }
+  }
 
 
-      //#pragma omp parallel for
-      for( k=0; k<=830-firstwav; k++ ){
+  /* Allocate memory for the XYZ values of a single scan line under each illuminant
+   */
+  float *calculated_XYZ = malloc( sizeof(float)*output_width*3*sets );
 
-	double val = gsl_spline_eval(spline, k+firstwav, acc);
-	if( val < 0 ) val = 0.0;
+  /* Fraction of valid pixels in each output pixel of a line for our alpha channel and
+     counts of saturated and empty pixels in the whole image for our statistics
+   */
+  float *calculated_alpha = alpha ? malloc( sizeof(float)*output_width ) : NULL;
+  unsigned long long flagged[2] = { 0, 0 };
+  unsigned long long *counting = verbose ? flagged : NULL;
 
-	X += val * cie_color_match[tr+k][1] * power_spectrum[te+k][1];
-	Y += val * cie_color_match[tr+k][2] * power_spectrum[te+k][1];
-	Z += val * cie_color_match[tr+k][3] * power_spectrum[te+k][1];
-      }
 
+  /* Direct output takes rows in any order, so if all our outputs are direct, render
+     whole lines in parallel, each thread with its own buffers, and let each thread
+     write its own rows. Spectral TIFF input and resampling need their lines in order
+   */
+  int direct = !resizing && !header.source;
+  for( n=0; n<target_count; n++ ) if( !targets[n].writer->direct ) direct = 0;
 
-      /* Free our interpolator
-       */
-      gsl_spline_free (spline);
-      gsl_interp_accel_free (acc);
+  int status = 0;
 
+  if( direct ){
 
-      float XX = (float)( (X * 100.0) / (norm) );
-      float YY = (float)( (Y * 100.0) / (norm) );
-      float ZZ = (float)( (Z * 100.0) / (norm) );
+    int failed = 0, unreadable = 0;
+    unsigned int done = 0;
 
+#pragma omp parallel
+    {
+      unsigned short *thread_scanline = malloc( header.samples * sizeof(unsigned short) * header.bands );
+      double *thread_binned = malloc( header.samples * sizeof(double) * header.bands );
+      double *thread_spectrum = malloc( sizeof(double) * header.bands );
+      float *thread_XYZ = malloc( sizeof(float)*output_width*3*sets );
+      float *thread_alpha = alpha ? malloc( sizeof(float)*output_width ) : NULL;
+      void **thread_color = malloc( sizeof(void*)*target_count );
+      int row, t;
 
-      /* Convert to RGB (sRGB or AdobeRGB)
-       */
-      if( colorspace == PHOTOMETRIC_RGB ){
+      for( t=0; t<target_count; t++ ){
+	thread_color[t] = malloc( output_pixel_size(&targets[t].format)*output_width );
+      }
 
-	float R, G, B;
+#pragma omp for schedule(dynamic)
+      for( row=0; row<(int)output_height; row++ ){
 
-	// Use appropriate color conversion matrix depending on color space and color temperature
-	if( icc_profile == 2 ){
-	  if( temperature == 5000 ) XYZ2RGB(XYZ_AdobeRGB_matrix_D50,XX,YY,ZZ,&R,&G,&B);
-	  else                      XYZ2RGB(XYZ_AdobeRGB_matrix_D65,XX,YY,ZZ,&R,&G,&B);
+	int stop;
 
-	  AdobeRGB_Gamma( &R, &G, &B );
+	/* Rows cannot be abandoned within a parallel loop, so skip those remaining
+	   once a scanline cannot be read or a row cannot be written
+	 */
+#pragma omp atomic read
+	stop = unreadable;
+	if( !stop ){
+#pragma omp atomic read
+	  stop = failed;
 	}
-	else{
-	  if( temperature == 5000 ) XYZ2RGB(XYZ_sRGB_matrix_D50,XX,YY,ZZ,&R,&G,&B);
-	  else                      XYZ2RGB(XYZ_sRGB_matrix_D65,XX,YY,ZZ,&R,&G,&B);
+	if( stop ) continue;
 
-	  sRGB_Gamma( &R, &G, &B );
+	if( render_line( in, &header, row, bin_x, bin_y, thread_scanline, thread_binned, thread_spectrum,
+			 &weights, thread_XYZ, thread_alpha, counting ) != 0 ){
+#pragma omp atomic write
+	  unreadable = 1;
+	  continue;
 	}
 
-	if( bits_per_sample == 32 ){
-	  ((float*)calculated_color)[i*3]     = R;
-	  ((float*)calculated_color)[i*3 + 1] = G;
-	  ((float*)calculated_color)[i*3 + 2] = B;
+	for( t=0; t<target_count; t++ ){
+	  encode_colors( &targets[t].format, thread_XYZ + (size_t)targets[t].set*output_width*3,
+			 thread_alpha, thread_color[t], output_width );
+	  if( write_output_row( targets[t].writer, thread_color[t], row ) != 0 ){
+#pragma omp atomic write
+	    failed = 1;
+	  }
 	}
-	else if( bits_per_sample == 16 ){
-	  ((unsigned short*)calculated_color)[i*3]     = (unsigned short)( R * 65535.0 );
-	  ((unsigned short*)calculated_color)[i*3 + 1] = (unsigned short)( G * 65535.0 );
-	  ((unsigned short*)calculated_color)[i*3 + 2] = (unsigned short)( B * 65535.0 );
-	}
-	else{
-	  ((unsigned char*)calculated_color)[i*3]     = (unsigned char)( R * 255.0 );
-	  ((unsigned char*)calculated_color)[i*3 + 1] = (unsigned char)( G * 255.0 );
-	  ((unsigned char*)calculated_color)[i*3 + 2] = (unsigned char)( B * 255.0 );
-	}
-      }
 
-      // CIE L*a*b* color space
-      else{
-	float L, a, b;
-	XYZ2LAB(XX,YY,ZZ,&L,&a,&b);
-
-	if( bits_per_sample == 8 ){
-	  ((unsigned char*)calculated_color)[i*3]     = (unsigned char)( L * 2.55 );
-	  ((unsigned char*)calculated_color)[i*3 + 1] = (signed char) (a);
-	  ((unsigned char*)calculated_color)[i*3 + 2] = (signed char) (b);
-	}
-	else if( bits_per_sample == 16 ){
-	  ((unsigned short*)calculated_color)[i*3]     = (unsigned short)( L * 655.35 );
-	  ((unsigned short*)calculated_color)[i*3 + 1] = (signed short)( a * 255.0 );
-	  ((unsigned short*)calculated_color)[i*3 + 2] = (signed short)( b * 255.0 );
-	}
-	else{
-          ((float*)calculated_color)[i*3] = L;
-          ((float*)calculated_color)[i*3 + 1] = a;
-	  ((float*)calculated_color)[i*3 + 2] = b;	  
+	/* Report progress
+	 */
+	if( verbose ){
+#pragma omp critical
+	  {
+	    done++;
+	    printf( "Processing: %3d\%%\r", (int)(done*100.0/output_height) );
+	    fflush( stdout );
+	  }
 	}
       }
+
+      for( t=0; t<target_count; t++ ) free( thread_color[t] );
+      free( thread_color );
+      free( thread_scanline );
+      free( thread_binned );
+      free( thread_spectrum );
+      free( thread_XYZ );
+      free( thread_alpha );
     }
 
+    if( failed ) fprintf( stderr, "TIFF write error\n" );
+    if( failed || unreadable ) status = 1;
+  }
 
-    /* Write out a whole scanline
+
+  /* Otherwise loop through our lines in order and calculate the CIE XYZ
+   */
+  else for( j=0; j<output_height; j++ ){
+
+    if( render_line( in, &header, j, bin_x, bin_y, scanline_spectrum, binned_spectrum, spectrum,
+		     &weights, calculated_XYZ, calculated_alpha, counting ) != 0 ){
+      status = 1;
+      break;
+    }
+
+    /* Write out our line to each output
      */
-    if( TIFFWriteScanline(out, (void*) calculated_color, j, 0) == -1 ){
-      printf( "TIFF write error at scanline %d \n", j );
+    for( n=0; n<target_count; n++ ){
+      if( write_target( &targets[n], calculated_XYZ + (size_t)targets[n].set*output_width*3, calculated_alpha ) != 0 ) break;
+    }
+
+    if( n < target_count ){
+      fprintf( stderr, "TIFF write error at scanline %d of '%s'\n", j, targets[n].filename );
+      status = 1;
       break;
     }
 
@@ -713,27 +1996,50 @@ int main( int argc, char *argv[] )
     /* Report progress
      */
     if( verbose ){
-      printf( "Processing: %3d\%%\r", (int)(j*100.0/header.scanlines) );
+      printf( "Processing: %3d\%%\r", (int)(j*100.0/output_height) );
       fflush( stdout );
     }
 
   }
 
-  /* Free our line of color output values
+  /* Report our invalid pixels
    */
-  free( calculated_color );
-  free( scanline_spectrum );
+  if( verbose ){
+    printf( "\nFlagged pixels: %llu saturated and %llu empty of %llu\n", flagged[0], flagged[1],
+	    (unsigned long long) header.samples * header.scanlines );
+  }
 
 
-  /* Free our integration workspace
+  /* Free our line of XYZ values and our weights
    */
-  gsl_integration_workspace_free( w );
+  free( calculated_XYZ );
+  free( calculated_alpha );
+  free_weights( &weights );
+  free( scanline_spectrum );
+  free( binned_spectrum );
+  free( spectrum );
 
 
   /* Close our files
    */
+  close_spectral_tiff( &header );
   if( in ) fclose( in );
-  if( out ) TIFFClose( out );
 
-  return 0;
+  for( n=0; n<target_count; n++ ){
+    target *t = &targets[n];
+    if( close_output( t->writer ) != 0 ){
+      fprintf( stderr, "TIFF write error while closing output image '%s'\n", t->filename );
+      status = 1;
+    }
+    free( t->color );
+    free( t->resized );
+    free( t->resized_alpha );
+    free_resizer( t->resampler );
+    free_resizer( t->alpha_resampler );
+    free( t->filename );
+  }
+  free( targets );
+  free( extra_outputs );
+
+  return status;
 }
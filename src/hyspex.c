@@ -22,8 +22,12 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
+#include <unistd.h>
 #include "hyspex.h"
+#include "spectral_tiff.h"
+#include "mask.h"
 
 #define HYSPEX_MAGIC "HYSPEX\0\0"
 #define HYSPEX_SIZE 8
@@ -44,7 +48,7 @@ int is_hyspex( FILE* s, hyspex_header *header )
    */
   unsigned char magic[8];
   if( fread( magic, 1, 8, s ) != 8 ){
-    printf("Unable to read header\n");
+    fprintf(stderr, "Unable to read header\n");
     return 1;
   }
 
@@ -87,9 +91,105 @@ int parse_envi_header( FILE *s, hyspex_header *header )
 }
 
 
+/* Parse an ENVI style list of values of the form "key = { v1, v2, ... }" from a block
+   of header text. Returns the number of values found
+ */
+int parse_envi_list( const char *text, const char *key, double **values )
+{
+  const char *p = text;
+  int count = 0, allocated = 0;
+
+  *values = NULL;
+
+  /* Find our key, skipping others such as "wavelength units"
+   */
+  while( ( p = strstr( p, key ) ) ){
+    p += strlen( key );
+    while( *p == ' ' || *p == '\t' ) p++;
+    if( *p == '=' ) break;
+  }
+  if( !p || !( p = strchr( p, '{' ) ) ) return 0;
+  p++;
+
+  while( *p && *p != '}' ){
+    char *end;
+    double w = strtod( p, &end );
+    if( end == p ){
+      p++;
+      continue;
+    }
+    if( count == allocated ){
+      allocated = allocated ? allocated*2 : 256;
+      *values = realloc( *values, sizeof(double) * allocated );
+    }
+    (*values)[count++] = w;
+    p = end;
+  }
+
+  return count;
+}
+
+
+
+/* Parse an ENVI style list of wavelengths of the form "wavelength = { w1, w2, ... }"
+ */
+int parse_envi_wavelengths( const char *text, double **wavelengths )
+{
+  return parse_envi_list( text, "wavelength", wavelengths );
+}
+
+
+
+/* Band widths are read from an ENVI style "fwhm = { ... }" list, which must have a
+   width for each of our bands
+ */
+void parse_envi_fwhm( const char *text, hyspex_header *header )
+{
+  double *fwhm = NULL;
+
+  if( parse_envi_list( text, "fwhm", &fwhm ) == (int) header->bands ) header->fwhm = fwhm;
+  else free( fwhm );
+}
+
+
+
+/* Load the text of the ENVI .hdr sidecar of a cube with the extension of its file
+   name replaced or, if appended is set, with .hdr appended. Returns NULL if there
+   is no such file
+ */
+char *load_envi_sidecar( const char *filename, int appended )
+{
+  char *sidecar = malloc( strlen(filename) + 5 );
+  char *dot, *text;
+  FILE *hdr;
+  off_t len;
+
+  strcpy( sidecar, filename );
+  dot = strrchr( sidecar, '.' );
+  if( !appended && dot && !strchr( dot, '/' ) ) strcpy( dot, ".hdr" );
+  else strcat( sidecar, ".hdr" );
+
+  hdr = fopen( sidecar, "r" );
+  free( sidecar );
+  if( !hdr ) return NULL;
+
+  fseeko( hdr, 0, SEEK_END );
+  len = ftello( hdr );
+  rewind( hdr );
+  text = malloc( len + 1 );
+  text[ fread( text, 1, len, hdr ) ] = '\0';
+  fclose( hdr );
+
+  return text;
+}
+
+
+
 int parse_hyspex_header( FILE *s, hyspex_header *header )
 {
-  long int hh;
+  /* Header fields are 4 byte integers
+   */
+  int32_t hh = 0;
 
   /* Rewind our file if necessary
    */
@@ -99,27 +199,27 @@ int parse_hyspex_header( FILE *s, hyspex_header *header )
    */
   unsigned char magic[8];
   if( fread( magic, 1, 8, s ) != 8 ){
-    printf("Unable to read header\n");
+    fprintf(stderr, "Unable to read header\n");
     return 1;
   }
   if( memcmp( magic, HYSPEX_MAGIC, 8 ) != 0 ){
-    printf("%s: Not a Hyspex file\n", magic );
+    fprintf(stderr, "%s: Not a Hyspex file\n", magic );
   }
   
   /* Header size
    */
-  fseek( s, HYSPEX_SIZE, SEEK_SET );
+  fseeko( s, HYSPEX_SIZE, SEEK_SET );
   if( fread( &hh, 4, 1, s ) != 1 ){
-    printf("Unable to read header\n");
+    fprintf(stderr, "Unable to read header\n");
     return 1;
   }
   header->size = hh;
 
   /* Number of bands
    */
-  fseek( s, HYSPEX_BANDS, SEEK_SET );
+  fseeko( s, HYSPEX_BANDS, SEEK_SET );
   if( fread( &hh, 4, 1, s ) != 1 ){
-    printf("Unable to read header\n");
+    fprintf(stderr, "Unable to read header\n");
     return 1;
   }
   header->bands = hh;
@@ -127,16 +227,16 @@ int parse_hyspex_header( FILE *s, hyspex_header *header )
   /* Number of samples
    */
   if( fread( &hh, 4, 1, s ) != 1 ){
-    printf("Unable to read header\n");
+    fprintf(stderr, "Unable to read header\n");
     return 1;
   }
   header->samples = hh;
 
   /* Number of scanlines
    */
-  fseek( s, HYSPEX_SCANLINES, SEEK_SET );
+  fseeko( s, HYSPEX_SCANLINES, SEEK_SET );
   if( fread( &hh, 4, 1, s ) != 1 ){
-    printf("Unable to read header\n");
+    fprintf(stderr, "Unable to read header\n");
     return 1;
   }
   header->scanlines = hh;
@@ -144,7 +244,7 @@ int parse_hyspex_header( FILE *s, hyspex_header *header )
   /* Number of bits per pixel
    */
   if( fread( &hh, 4, 1, s ) != 1 ){
-    printf("Unable to read header\n");
+    fprintf(stderr, "Unable to read header\n");
     return 1;
   }
   header->bpp = 2;
@@ -153,12 +253,12 @@ int parse_hyspex_header( FILE *s, hyspex_header *header )
   /* Extract list of wavelengths
    */
   header->wavelengths = malloc( sizeof(double) * header->bands );
-  fseek( s, HYSPEX_WAVELENGTHS, SEEK_SET );
+  fseeko( s, HYSPEX_WAVELENGTHS, SEEK_SET );
   int n;
   double w;
   for( n=0; n<header->bands; n++ ){
     if( fread( &w, 8, 1, s ) != 1 ){
-      printf("Unable to read header\n");
+      fprintf(stderr, "Unable to read header\n");
       return 1;
     }
     header->wavelengths[n] = w;
@@ -170,7 +270,7 @@ int parse_hyspex_header( FILE *s, hyspex_header *header )
   /*  header->responsivities = malloc( sizeof(double) * header->bands * header->samples );*/
   for( n=0; n<header->bands*header->samples; n++ ){
     if( fread( &w, 8, 1, s ) != 1 ){
-      printf("Unable to read header\n");
+      fprintf(stderr, "Unable to read header\n");
       return 1;
     }
 /*     header->responsivities[n] = w; */
@@ -181,7 +281,7 @@ int parse_hyspex_header( FILE *s, hyspex_header *header )
   header->QE = malloc( sizeof(double) * header->bands );
   for( n=0; n<header->bands; n++ ){
     if( fread( &w, 8, 1, s ) != 1 ){
-      printf("Unable to read header\n");
+      fprintf(stderr, "Unable to read header\n");
       return 1;
     }
     header->QE[n] = w;
@@ -192,7 +292,7 @@ int parse_hyspex_header( FILE *s, hyspex_header *header )
   /* header->background = malloc( sizeof(double) * header->bands * header->samples ); */
   for( n=0; n<header->bands*header->samples; n++ ){
     if( fread( &w, 8, 1, s ) != 1 ){
-      printf("Unable to read header\n");
+      fprintf(stderr, "Unable to read header\n");
       return 1;
     }
 /*     header->background[n] = w; */
@@ -213,40 +313,105 @@ int parse_hyspex_header( FILE *s, hyspex_header *header )
  */
 int load_hyspex_pixel( FILE* s, hyspex_header *header, double *spectrum, int x, int y )
 {
-  unsigned short pixel;
-  size_t index = header->size + ((size_t)y * (size_t)header->bpp * (size_t)header->samples * (size_t)header->bands) + (x * (size_t)header->bpp);
+  hyspex_coord coord;
+  coord.x = x;
+  coord.y = y;
+  coord.index = 0;
 
-  unsigned int n = 0;
+  return load_hyspex_pixels( s, header, &coord, 1, spectrum );
+}
 
-  for( n=0; n<header->bands; n++ ){
-    fseek( s, index, SEEK_SET );
-    if( fread( &pixel, (size_t)header->bpp, 1, s ) != 1 ){
-      printf("Unable to read pixel data for band %d\n", n);
+
+
+/* Order pixel coordinates by scanline and then by position in the request list
+ */
+static int compare_coords( const void *a, const void *b )
+{
+  const hyspex_coord *p = (const hyspex_coord*) a;
+  const hyspex_coord *q = (const hyspex_coord*) b;
+
+  if( p->y != q->y ) return ( p->y < q->y ) ? -1 : 1;
+  if( p->index != q->index ) return ( p->index < q->index ) ? -1 : 1;
+  return 0;
+}
+
+
+
+/* Load the spectral curves of a list of pixels. Assume BIL. Coordinates are sorted
+   by scanline so that each scanline containing requested pixels is read only once. Spectrum n is stored at spectra[index*bands]
+ */
+int load_hyspex_pixels( FILE* s, hyspex_header *header, hyspex_coord *coords, int count, double *spectra )
+{
+  size_t line_size = (size_t)header->bpp * (size_t)header->samples * (size_t)header->bands;
+  unsigned char *line = malloc( line_size );
+  int n;
+  unsigned int k;
+
+  if( !line ){
+    fprintf(stderr, "Unable to allocate scanline buffer\n");
+    return 1;
+  }
+
+  qsort( coords, count, sizeof(hyspex_coord), compare_coords );
+
+  for( n=0; n<count; n++ ){
+
+    if( coords[n].x >= header->samples || coords[n].y >= header->scanlines ){
+      fprintf(stderr, "Pixel %u,%u lies outside the image\n", coords[n].x, coords[n].y );
+      free( line );
       return 1;
     }
-    if( header->bpp == 2 ) spectrum[n] = (double)pixel / 65535.0;
-    else spectrum[n] = (double)pixel;
 
-    index += (size_t)header->samples * (size_t)header->bpp;
+    /* Read each scanline once, on the first pixel that needs it
+     */
+    if( n == 0 || coords[n].y != coords[n-1].y ){
+      if( load_hyspex_bil( s, header, line, coords[n].y ) != (size_t)header->samples * header->bands ){
+	fprintf(stderr, "Unable to read pixel data for scanline %u\n", coords[n].y );
+	free( line );
+	return 1;
+      }
+    }
+
+    double *spectrum = spectra + (size_t)coords[n].index * header->bands;
+
+    for( k=0; k<header->bands; k++ ){
+      size_t p = (size_t)k * header->samples + coords[n].x;
+      if( header->bpp == 2 ) spectrum[k] = (double)((unsigned short*)line)[p] / 65535.0;
+      else spectrum[k] = (double)line[p];
+    }
   }
 
+  free( line );
+
   return 0;
 }
 
 
 
-/* Load a spectral curve. Assume BIL. Return number of pixels loaded
+/* Load a spectral curve. Assume BIL. Bad columns and pixels are repaired if we have
+   a mask. Return number of pixels loaded
  */
-int load_hyspex_bil( FILE* s, hyspex_header *header, void *buffer, int y )
+size_t load_hyspex_bil( FILE* s, hyspex_header *header, void *buffer, unsigned int y )
 {
-  int size;
-
-  size_t index = header->size + ((size_t)y * (size_t)header->bpp * (size_t)header->samples * (size_t)header->bands);
+  size_t line_size = (size_t)header->bpp * (size_t)header->samples * (size_t)header->bands;
+  off_t index = (off_t)header->size + ((off_t)y * (off_t)line_size);
+  size_t loaded = 0;
+  ssize_t n;
+
+  if( header->source ) loaded = load_spectral_tiff_bil( header, buffer, y ) * header->bpp;
+  else{
+    /* Use pread with an explicit 64 bit offset, looping in case of short reads
+     */
+    while( loaded < line_size ){
+      n = pread( fileno(s), (unsigned char*)buffer + loaded, line_size - loaded, index + loaded );
+      if( n <= 0 ) break;
+      loaded += n;
+    }
+  }
 
-  fseek( s, index, SEEK_SET );
-  size = fread( buffer, (size_t)header->bpp, header->samples*header->bands, s );
+  if( header->mask && loaded == line_size ) repair_scanline( header->mask, buffer );
 
-  return size;
+  return loaded / header->bpp;
 }
 
 
@@ -264,5 +429,6 @@ void free_hyspex( hyspex_header *header ){
   /* Free our memory
    */
   free( header->wavelengths );
+  free( header->fwhm );
   free( header->QE );
 }
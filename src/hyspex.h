@@ -20,7 +20,15 @@
 */
 
 
+#ifndef HYSPEX_H
+#define HYSPEX_H
+
+
 #include <stdio.h>
+#include <sys/types.h>
+
+
+struct pixel_mask;
 
 
 /* Hyspex header structure
@@ -32,17 +40,39 @@ typedef struct {
   unsigned int scanlines;
   unsigned int bpp;
   double *wavelengths;
+  double *fwhm;      /* Full width at half maximum of each band in nm or NULL if unknown */
 
   double *responsivities;
   double *QE;
   double *background;
 
+  void *source;      /* Alternative input such as a spectral TIFF or NULL for raw BIL */
+  struct pixel_mask *mask;  /* Bad columns and pixels repaired in each scanline or NULL */
+
 } hyspex_header;
 
 
+/* Pixel coordinate for batched spectrum loading. Index gives the position of
+   the pixel's spectrum in the output array
+ */
+typedef struct {
+  unsigned int x;
+  unsigned int y;
+  unsigned int index;
+} hyspex_coord;
+
+
 int is_hyspex( FILE*, hyspex_header* );
 int parse_hyspex_header( FILE*, hyspex_header* );
+int parse_envi_list( const char*, const char*, double** );
+int parse_envi_wavelengths( const char*, double** );
+void parse_envi_fwhm( const char*, hyspex_header* );
+char *load_envi_sidecar( const char*, int );
 int load_hyspex_pixel( FILE*, hyspex_header*, double*, int, int );
-int load_hyspex_bil( FILE*, hyspex_header*, void*, int );
+int load_hyspex_pixels( FILE*, hyspex_header*, hyspex_coord*, int, double* );
+size_t load_hyspex_bil( FILE*, hyspex_header*, void*, unsigned int );
 void update_width( hyspex_header*, int );
 void free_hyspex( hyspex_header* );
+
+
+#endif
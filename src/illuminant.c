@@ -0,0 +1,328 @@
+/*
+    Illuminant and observer library
+
+    Copyright (c) 2015-2024, Ruven <ruven@users.sourceforge.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+
+*/
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include "illuminant.h"
+
+
+/* CIE 1931 2 degree color matching functions from 360 to 830nm at 1nm, CIE 1964
+   10 degree functions from 380 to 780nm at 5nm, illuminants A and D65 from 300 to
+   830nm at 1nm, the daylight components S0, S1 and S2 from 300 to 830nm at 10nm and
+   fluorescent illuminants from 380 to 780nm at 5nm
+ */
+#include "CIE-tristimulus.c"
+#include "CIE-tristimulus-1964.c"
+#include "CIE-D65.c"
+#include "CIE-A.c"
+#include "CIE-daylight.c"
+#include "CIE-F.c"
+
+
+/* Function to calculate the blackbody spectrum for a particular temperature
+   for the desired wavelength, which should be given in nm
+*/
+double calculate_power_spectrum( int bbTemp, int wavelength ){
+
+  double power;
+  double wlm = wavelength * 1e-9;  /* Convert from nm to meters */
+  power = 3.74177152e-16  /
+    ( pow( wlm, 5 ) * ( exp( 0.0143877696 / (wlm * bbTemp) ) - 1.0 ) );
+
+  return power;
+}
+
+
+
+/* Linearly interpolate values sampled at increasing wavelengths onto our 1nm grid.
+   Wavelengths outside of the sampled range are given zero power
+ */
+static void resample( unsigned int count, const double *wavelengths, const double *values, double *power )
+{
+  unsigned int i = 0;
+  int k;
+
+  for( k=ILLUMINANT_FIRST; k<=ILLUMINANT_LAST; k++ ){
+
+    if( k < wavelengths[0] || k > wavelengths[count-1] ){
+      power[k-ILLUMINANT_FIRST] = 0.0;
+      continue;
+    }
+    while( i < count-2 && wavelengths[i+1] < k ) i++;
+
+    double t = ( k - wavelengths[i] ) / ( wavelengths[i+1] - wavelengths[i] );
+    power[k-ILLUMINANT_FIRST] = ( 1.0 - t ) * values[i] + t * values[i+1];
+  }
+}
+
+
+
+/* Resample a column of one of our tables
+ */
+static void resample_table( const double *table, unsigned int rows, unsigned int columns,
+			    unsigned int column, double *power )
+{
+  double *wavelengths = malloc( sizeof(double) * rows );
+  double *values = malloc( sizeof(double) * rows );
+  unsigned int i;
+
+  for( i=0; i<rows; i++ ){
+    wavelengths[i] = table[i*columns];
+    values[i] = table[i*columns + column];
+  }
+  resample( rows, wavelengths, values, power );
+
+  free( wavelengths );
+  free( values );
+}
+
+
+
+/* CIE daylight illuminant for a correlated color temperature between 4000 and
+   25000K, combined from the daylight components with coefficients rounded to three
+   decimal places as recommended by CIE 15
+ */
+static void daylight_power( double cct, double *power )
+{
+  double s[3][ILLUMINANT_SIZE];
+  double x, y, m, m1, m2;
+  int c, k;
+
+  if( cct <= 7000.0 ) x = -4.6070e9 / pow( cct, 3 ) + 2.9678e6 / pow( cct, 2 ) + 0.09911e3 / cct + 0.244063;
+  else x = -2.0064e9 / pow( cct, 3 ) + 1.9018e6 / pow( cct, 2 ) + 0.24748e3 / cct + 0.237040;
+  y = -3.000 * x * x + 2.870 * x - 0.275;
+
+  m = 0.0241 + 0.2562 * x - 0.7341 * y;
+  m1 = round( 1000.0 * ( -1.3515 - 1.7703 * x + 5.9114 * y ) / m ) / 1000.0;
+  m2 = round( 1000.0 * ( 0.0300 - 31.4424 * x + 30.0717 * y ) / m ) / 1000.0;
+
+  for( c=0; c<3; c++ ) resample_table( &CIE_daylight[0][0], 54, 4, c+1, s[c] );
+  for( k=0; k<ILLUMINANT_SIZE; k++ ) power[k] = s[0][k] + m1 * s[1][k] + m2 * s[2][k];
+}
+
+
+
+/* Load an illuminant power spectrum from a text file of wavelength and power pairs,
+   one per line, at any sampling. Blank lines, comments and headers are skipped
+ */
+static int load_power_spectrum( const char *filename, double *power )
+{
+  FILE *file;
+  char line[256];
+  double *wavelengths = NULL, *values = NULL;
+  double wavelength, value;
+  unsigned int count = 0;
+  int status = 0;
+
+  if( ! ( file = fopen( filename, "r" ) ) ){
+    fprintf( stderr, "Unknown illuminant or unreadable power spectrum file: '%s'\n", filename );
+    return 1;
+  }
+
+  while( fgets( line, sizeof(line), file ) ){
+    if( line[0] == '#' ) continue;
+    if( sscanf( line, "%lf%*[ ,;\t]%lf", &wavelength, &value ) != 2 ) continue;
+    if( count && wavelength <= wavelengths[count-1] ){
+      fprintf( stderr, "Power spectrum wavelengths must be increasing: '%s'\n", filename );
+      status = 1;
+      break;
+    }
+    wavelengths = realloc( wavelengths, sizeof(double) * (count+1) );
+    values = realloc( values, sizeof(double) * (count+1) );
+    wavelengths[count] = wavelength;
+    values[count++] = value;
+  }
+  fclose( file );
+
+  if( status == 0 && count < 2 ){
+    fprintf( stderr, "Power spectrum file needs at least two wavelengths: '%s'\n", filename );
+    status = 1;
+  }
+
+  if( status == 0 ) resample( count, wavelengths, values, power );
+
+  free( wavelengths );
+  free( values );
+
+  return status;
+}
+
+
+
+/* Load the power spectrum of an illuminant onto our 1nm grid. Illuminants can be
+   CIE A, tabulated D65, any other D series daylight either as a nominal temperature
+   in hundreds of Kelvin (D50, D55, D75 ...) or in Kelvin (D6000), the fluorescent
+   F series, equal energy E, a blackbody temperature in Kelvin or a power spectrum
+   file. Returns 1 if the illuminant is unknown
+ */
+int illuminant_power( const char *name, double *power )
+{
+  const char *digits = name + 1;
+  int k;
+
+  while( *digits && isdigit( *digits ) ) digits++;
+
+  if( strcmp( name, "A" ) == 0 ){
+    for( k=0; k<ILLUMINANT_SIZE; k++ ) power[k] = CIE_A[k][1];
+  }
+  else if( strcmp( name, "D65" ) == 0 ){
+    for( k=0; k<ILLUMINANT_SIZE; k++ ) power[k] = D65[k][1];
+  }
+  else if( strcmp( name, "E" ) == 0 ){
+    for( k=0; k<ILLUMINANT_SIZE; k++ ) power[k] = 100.0;
+  }
+  else if( name[0] == 'D' && name[1] && *digits == '\0' ){
+    /* Nominal temperatures follow the revised value of the second radiation constant
+     */
+    double cct = atoi( name + 1 );
+    if( cct < 100 ) cct *= 100.0 * 1.4388 / 1.4380;
+    if( cct < 4000 || cct > 25000 ){
+      fprintf( stderr, "Daylight illuminants are only defined from 4000 to 25000K: '%s'\n", name );
+      return 1;
+    }
+    daylight_power( cct, power );
+  }
+  else if( name[0] == 'F' && name[1] && *digits == '\0' ){
+    unsigned int n = atoi( name + 1 );
+    if( n < 1 || n > 12 ){
+      fprintf( stderr, "Fluorescent illuminant not available: '%s'\n", name );
+      return 1;
+    }
+    resample_table( &CIE_F[0][0], 81, 13, n, power );
+  }
+  else if( isdigit( name[0] ) && *digits == '\0' ){
+    int temperature = atoi( name );
+    if( temperature <= 0 ){
+      fprintf( stderr, "Invalid color temperature: '%s'\n", name );
+      return 1;
+    }
+    for( k=ILLUMINANT_FIRST; k<=ILLUMINANT_LAST; k++ ){
+      power[k-ILLUMINANT_FIRST] = calculate_power_spectrum( temperature, k );
+    }
+  }
+  else return load_power_spectrum( name, power );
+
+  return 0;
+}
+
+
+
+/* Load the color matching functions of an observer onto our 1nm grid
+ */
+void observer_match( int observer, double match[][3] )
+{
+  int c, k;
+
+  if( observer == OBSERVER_10 ){
+    double column[ILLUMINANT_SIZE];
+    for( c=0; c<3; c++ ){
+      resample_table( &cie_color_match_10[0][0], 81, 4, c+1, column );
+      for( k=0; k<ILLUMINANT_SIZE; k++ ) match[k][c] = column[k];
+    }
+    return;
+  }
+
+  for( k=ILLUMINANT_FIRST; k<=ILLUMINANT_LAST; k++ ){
+    int row = k - (int) cie_color_match[0][0];
+    for( c=0; c<3; c++ ){
+      match[k-ILLUMINANT_FIRST][c] = ( row < 0 ) ? 0.0 : cie_color_match[row][c+1];
+    }
+  }
+}
+
+
+
+/* Load camera spectral sensitivities onto our 1nm grid in place of the color
+   matching functions of an observer from a text file with a wavelength followed by
+   the red, green and blue sensitivities on each line. Blank lines, comments and
+   headers are skipped
+ */
+int camera_match( const char *filename, double match[][3] )
+{
+  FILE *file;
+  char line[256];
+  double *wavelengths = NULL, *values[3] = { NULL, NULL, NULL };
+  double wavelength, rgb[3];
+  double column[ILLUMINANT_SIZE];
+  unsigned int count = 0;
+  int status = 0, c, k;
+
+  if( ! ( file = fopen( filename, "r" ) ) ){
+    fprintf( stderr, "Unable to open camera sensitivity file: '%s'\n", filename );
+    return 1;
+  }
+
+  while( fgets( line, sizeof(line), file ) ){
+    if( line[0] == '#' ) continue;
+    if( sscanf( line, "%lf%*[ ,;\t]%lf%*[ ,;\t]%lf%*[ ,;\t]%lf",
+		&wavelength, &rgb[0], &rgb[1], &rgb[2] ) != 4 ) continue;
+    if( count && wavelength <= wavelengths[count-1] ){
+      fprintf( stderr, "Camera sensitivity wavelengths must be increasing: '%s'\n", filename );
+      status = 1;
+      break;
+    }
+    wavelengths = realloc( wavelengths, sizeof(double) * (count+1) );
+    wavelengths[count] = wavelength;
+    for( c=0; c<3; c++ ){
+      values[c] = realloc( values[c], sizeof(double) * (count+1) );
+      values[c][count] = rgb[c];
+    }
+    count++;
+  }
+  fclose( file );
+
+  if( status == 0 && count < 2 ){
+    fprintf( stderr, "Camera sensitivity file needs at least two wavelengths: '%s'\n", filename );
+    status = 1;
+  }
+
+  if( status == 0 ){
+    for( c=0; c<3; c++ ){
+      resample( count, wavelengths, values[c], column );
+      for( k=0; k<ILLUMINANT_SIZE; k++ ) match[k][c] = column[k];
+    }
+  }
+
+  free( wavelengths );
+  for( c=0; c<3; c++ ) free( values[c] );
+
+  return status;
+}
+
+
+
+/* Calculate the CIE XYZ white point of an illuminant over the full range of our
+   color matching functions, scaled to Y=100
+ */
+void illuminant_white( const double *power, double match[][3], double *white )
+{
+  double sum[3] = { 0.0, 0.0, 0.0 };
+  int c, k;
+
+  for( k=0; k<ILLUMINANT_SIZE; k++ ){
+    for( c=0; c<3; c++ ) sum[c] += match[k][c] * power[k];
+  }
+  for( c=0; c<3; c++ ) white[c] = 100.0 * sum[c] / sum[1];
+}
@@ -0,0 +1,48 @@
+/*
+    Illuminant and observer library
+
+    Copyright (c) 2015-2024, Ruven <ruven@users.sourceforge.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+
+*/
+
+
+#ifndef ILLUMINANT_H
+#define ILLUMINANT_H
+
+
+/* Illuminant power spectra and color matching functions are resampled onto a
+   common grid at 1nm intervals from 300 to 830nm
+ */
+#define ILLUMINANT_FIRST 300
+#define ILLUMINANT_LAST 830
+#define ILLUMINANT_SIZE ( ILLUMINANT_LAST - ILLUMINANT_FIRST + 1 )
+
+
+/* Standard observers: CIE 1931 2 degree and CIE 1964 10 degree
+ */
+#define OBSERVER_2 2
+#define OBSERVER_10 10
+
+
+double calculate_power_spectrum( int, int );
+int illuminant_power( const char*, double* );
+void observer_match( int, double[][3] );
+int camera_match( const char*, double[][3] );
+void illuminant_white( const double*, double[][3], double* );
+
+
+#endif
@@ -0,0 +1,136 @@
+/*
+    Bad band, column and pixel masks
+
+    Copyright (c) 2015-2024, Ruven <ruven@users.sourceforge.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+
+*/
+
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "mask.h"
+
+
+
+/* Load a mask file with one entry per line: "band N" or "column N" for a single
+   band or column, or a range given as N-M, and "pixel X B" for the detector pixel
+   at column X of band B. Bands and columns count from zero. Blank lines and
+   comments are skipped. Returns 1 on error
+ */
+int load_mask( const char *filename, hyspex_header *header, pixel_mask *mask )
+{
+  FILE *file;
+  char line[256], kind[16];
+  unsigned int samples = header->samples, bands = header->bands;
+  unsigned int first, last, n, k;
+  int status = 0;
+
+  mask->bands = bands;
+  mask->samples = samples;
+  mask->bad_band = calloc( bands, 1 );
+  mask->bad = calloc( (size_t) samples * bands, 1 );
+  mask->count = 0;
+
+  if( ! ( file = fopen( filename, "r" ) ) ){
+    fprintf( stderr, "Unable to open mask file: '%s'\n", filename );
+    return 1;
+  }
+
+  while( status == 0 && fgets( line, sizeof(line), file ) ){
+
+    int fields;
+
+    if( line[0] == '#' ) continue;
+    if( ( fields = sscanf( line, "%15s %u%*[- ,\t]%u", kind, &first, &last ) ) < 2 ) continue;
+    if( fields == 2 ) last = first;
+
+    if( strcmp( kind, "band" ) == 0 ){
+      if( last < first || last >= bands ) status = 1;
+      else for( n=first; n<=last; n++ ) mask->bad_band[n] = 1;
+    }
+    else if( strcmp( kind, "column" ) == 0 ){
+      if( last < first || last >= samples ) status = 1;
+      else for( n=first; n<=last; n++ ) for( k=0; k<bands; k++ ) mask->bad[(size_t)k*samples + n] = 1;
+    }
+    else if( strcmp( kind, "pixel" ) == 0 && fields == 3 ){
+      if( first >= samples || last >= bands ) status = 1;
+      else mask->bad[(size_t)last*samples + first] = 1;
+    }
+    else status = 1;
+
+    if( status != 0 ) fprintf( stderr, "Invalid mask entry: %s", line );
+  }
+  fclose( file );
+
+  for( n=0; n<samples*bands; n++ ) mask->count += mask->bad[n];
+
+  return status;
+}
+
+
+
+/* Repair the bad columns and pixels of a scanline in place. Each run of bad samples
+   within a band is linearly interpolated between the good samples either side of
+   it, or copied from the one good neighbour at the edges of the scanline
+ */
+void repair_scanline( pixel_mask *mask, unsigned short *scanline )
+{
+  unsigned int samples = mask->samples;
+  unsigned int x, k, i;
+
+  if( mask->count == 0 ) return;
+
+  for( k=0; k<mask->bands; k++ ){
+
+    const unsigned char *bad = mask->bad + (size_t)k * samples;
+    unsigned short *band = scanline + (size_t)k * samples;
+
+    for( x=0; x<samples; ){
+
+      unsigned int start = x;
+      int left, right;
+
+      if( !bad[x] ){ x++; continue; }
+      while( x < samples && bad[x] ) x++;
+
+      left = (int) start - 1;
+      right = ( x < samples ) ? (int) x : -1;
+      if( left < 0 && right < 0 ) break;
+
+      for( i=start; i<x; i++ ){
+	if( left < 0 ) band[i] = band[right];
+	else if( right < 0 ) band[i] = band[left];
+	else{
+	  double t = (double)( (int) i - left ) / (double)( right - left );
+	  band[i] = (unsigned short)( ( 1.0 - t ) * band[left] + t * band[right] + 0.5 );
+	}
+      }
+    }
+  }
+}
+
+
+
+void free_mask( pixel_mask *mask )
+{
+  free( mask->bad_band );
+  free( mask->bad );
+  mask->bad_band = NULL;
+  mask->bad = NULL;
+}
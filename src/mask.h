@@ -0,0 +1,50 @@
+/*
+    Bad band, column and detector pixel mask structure
+
+    Copyright (c) 2015-2024, Ruven <ruven@users.sourceforge.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+
+*/
+
+
+
+#ifndef MASK_H
+#define MASK_H
+
+
+#include "hyspex.h"
+
+
+/* Bad bands, columns and pixels of a pushbroom detector, whose pixels are each a
+   column and band of every scanline. Bad bands are left out of our rendering
+   weights, while bad columns and pixels are repaired in each scanline by
+   interpolating between their good neighbours along the scanline
+ */
+typedef struct pixel_mask {
+  unsigned int bands;
+  unsigned int samples;
+  unsigned char *bad_band;    /* Flag for each band */
+  unsigned char *bad;         /* Flag for each column of each band, stored like a scanline */
+  unsigned int count;         /* Number of bad columns and pixels */
+} pixel_mask;
+
+
+int load_mask( const char*, hyspex_header*, pixel_mask* );
+void repair_scanline( pixel_mask*, unsigned short* );
+void free_mask( pixel_mask* );
+
+
+#endif
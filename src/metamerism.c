@@ -0,0 +1,228 @@
+/*
+    Metamerism maps: color differences of each pixel between illuminants
+
+    Copyright (c) 2015-2024, Ruven <ruven@users.sourceforge.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "metamerism.h"
+#include "color.h"
+
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+
+
+/* Set up a metamerism map for the illuminants stacked in our weights. Each
+   illuminant is compared relative to its own white point
+ */
+int create_metamerism( metamerism *m, render_weights *weights, int formula, unsigned int width )
+{
+  unsigned int n;
+
+  if( weights->sets < 2 ){
+    fprintf( stderr, "Metamerism maps need at least two illuminants\n" );
+    return 1;
+  }
+
+  m->formula = formula;
+  m->illuminants = weights->sets;
+  m->width = width;
+  m->white = malloc( sizeof(double) * 3 * weights->sets );
+  m->L = malloc( sizeof(float) * width * weights->sets );
+  m->a = malloc( sizeof(float) * width * weights->sets );
+  m->b = malloc( sizeof(float) * width * weights->sets );
+  m->delta = malloc( sizeof(float) * width );
+  m->stats = calloc( weights->sets - 1, sizeof(delta_e_stats) );
+  for( n=0; n<weights->sets-1; n++ ){
+    m->stats[n].histogram = calloc( DELTA_E_BINS, sizeof(unsigned long long) );
+  }
+
+  for( n=0; n<3*weights->sets; n++ ) m->white[n] = weights->white[n];
+
+  return 0;
+}
+
+
+
+/* CIEDE2000 color difference following Sharma, Wu and Dalal (2005)
+ */
+static float delta_e2000( float L1, float a1, float b1, float L2, float a2, float b2 )
+{
+  const double p25 = 6103515625.0;   /* 25^7 */
+  double C1 = sqrt( a1*a1 + b1*b1 ), C2 = sqrt( a2*a2 + b2*b2 );
+  double Cm = ( C1 + C2 ) / 2.0, Cm7 = pow( Cm, 7 );
+  double G = 0.5 * ( 1.0 - sqrt( Cm7 / ( Cm7 + p25 ) ) );
+  double a1p = ( 1.0 + G ) * a1, a2p = ( 1.0 + G ) * a2;
+  double C1p = sqrt( a1p*a1p + b1*b1 ), C2p = sqrt( a2p*a2p + b2*b2 );
+  double h1p = ( a1p == 0.0 && b1 == 0.0 ) ? 0.0 : atan2( b1, a1p );
+  double h2p = ( a2p == 0.0 && b2 == 0.0 ) ? 0.0 : atan2( b2, a2p );
+  double dLp, dCp, dhp, dHp, Lpm, Cpm, hpm, Cpm7, T, dtheta, Rc, Sl, Sc, Sh, Rt, l;
+
+  if( h1p < 0.0 ) h1p += 2.0*M_PI;
+  if( h2p < 0.0 ) h2p += 2.0*M_PI;
+
+  dLp = L2 - L1;
+  dCp = C2p - C1p;
+
+  if( C1p * C2p == 0.0 ) dhp = 0.0;
+  else{
+    dhp = h2p - h1p;
+    if( dhp > M_PI ) dhp -= 2.0*M_PI;
+    else if( dhp < -M_PI ) dhp += 2.0*M_PI;
+  }
+  dHp = 2.0 * sqrt( C1p * C2p ) * sin( dhp / 2.0 );
+
+  Lpm = ( L1 + L2 ) / 2.0;
+  Cpm = ( C1p + C2p ) / 2.0;
+
+  if( C1p * C2p == 0.0 ) hpm = h1p + h2p;
+  else if( fabs( h1p - h2p ) <= M_PI ) hpm = ( h1p + h2p ) / 2.0;
+  else if( h1p + h2p < 2.0*M_PI ) hpm = ( h1p + h2p + 2.0*M_PI ) / 2.0;
+  else hpm = ( h1p + h2p - 2.0*M_PI ) / 2.0;
+
+  T = 1.0 - 0.17 * cos( hpm - M_PI/6.0 ) + 0.24 * cos( 2.0*hpm ) +
+    0.32 * cos( 3.0*hpm + M_PI/30.0 ) - 0.20 * cos( 4.0*hpm - 63.0*M_PI/180.0 );
+
+  dtheta = ( M_PI/6.0 ) * exp( -pow( ( hpm*180.0/M_PI - 275.0 ) / 25.0, 2 ) );
+  Cpm7 = pow( Cpm, 7 );
+  Rc = 2.0 * sqrt( Cpm7 / ( Cpm7 + p25 ) );
+  l = ( Lpm - 50.0 ) * ( Lpm - 50.0 );
+  Sl = 1.0 + 0.015 * l / sqrt( 20.0 + l );
+  Sc = 1.0 + 0.045 * Cpm;
+  Sh = 1.0 + 0.015 * Cpm * T;
+  Rt = -sin( 2.0 * dtheta ) * Rc;
+
+  dLp /= Sl;
+  dCp /= Sc;
+  dHp /= Sh;
+
+  return (float) sqrt( dLp*dLp + dCp*dCp + dHp*dHp + Rt * dCp * dHp );
+}
+
+
+
+/* Calculate the color differences for a line of XYZ values, given as a line for each
+   illuminant in turn. The map receives one difference per pixel for each illuminant
+   after the first. Pixels which are black under our reference illuminant, such as
+   padding, are left out of our statistics
+ */
+void metamerism_line( metamerism *m, const float *XYZ, float *map )
+{
+  unsigned int width = m->width, maps = m->illuminants - 1;
+  unsigned int n, i;
+
+  /* Convert each illuminant's line to CIE L*a*b* relative to its own white, exactly
+     as for CIELAB output
+   */
+  for( n=0; n<m->illuminants; n++ ){
+    const float *xyz = XYZ + (size_t) n * width * 3;
+    const double *white = m->white + n*3;
+    float *L = m->L + (size_t) n * width, *a = m->a + (size_t) n * width, *b = m->b + (size_t) n * width;
+    for( i=0; i<width; i++ ) XYZ2LAB( xyz[i*3], xyz[i*3 + 1], xyz[i*3 + 2], white, &L[i], &a[i], &b[i] );
+  }
+
+  for( n=1; n<m->illuminants; n++ ){
+
+    const float *L0 = m->L, *a0 = m->a, *b0 = m->b;
+    const float *L1 = m->L + (size_t) n * width, *a1 = m->a + (size_t) n * width, *b1 = m->b + (size_t) n * width;
+    delta_e_stats *stats = &m->stats[n-1];
+    float *delta = m->delta;
+
+    if( m->formula == DELTA_E_76 ){
+      for( i=0; i<width; i++ ){
+	float dL = L1[i] - L0[i], da = a1[i] - a0[i], db = b1[i] - b0[i];
+	delta[i] = sqrtf( dL*dL + da*da + db*db );
+      }
+    }
+    else{
+      for( i=0; i<width; i++ ) delta[i] = delta_e2000( L0[i], a0[i], b0[i], L1[i], a1[i], b1[i] );
+    }
+
+    for( i=0; i<width; i++ ){
+      map[(size_t) i*maps + n-1] = delta[i];
+      if( XYZ[i*3 + 1] > 0.0f ){
+	unsigned int bin = ( delta[i] < ( DELTA_E_BINS - 1 ) / 100.0f ) ? (unsigned int)( delta[i] * 100.0f ) : DELTA_E_BINS - 1;
+	stats->histogram[bin]++;
+	stats->count++;
+	stats->sum += delta[i];
+	if( delta[i] > stats->max ) stats->max = delta[i];
+      }
+    }
+  }
+}
+
+
+
+/* Find the value below which a fraction of our differences lie from our histogram
+ */
+static float percentile( delta_e_stats *stats, double fraction )
+{
+  unsigned long long target = (unsigned long long) ceil( fraction * stats->count ), sum = 0;
+  unsigned int bin;
+
+  for( bin=0; bin<DELTA_E_BINS-1; bin++ ){
+    sum += stats->histogram[bin];
+    if( sum >= target ) return ( bin + 1 ) / 100.0f;
+  }
+
+  return stats->max;
+}
+
+
+
+/* Print the mean, median, 95th percentile and maximum difference for each illuminant
+ */
+void print_metamerism( metamerism *m, const char **illuminants, FILE *out )
+{
+  unsigned int n;
+
+  for( n=1; n<m->illuminants; n++ ){
+
+    delta_e_stats *stats = &m->stats[n-1];
+
+    fprintf( out, "Delta E %d from %s to %s: ", m->formula, illuminants[0], illuminants[n] );
+    if( stats->count == 0 ){
+      fprintf( out, "no pixels\n" );
+      continue;
+    }
+    fprintf( out, "mean %.3f, median %.2f, 95th percentile %.2f, maximum %.3f over %llu pixels\n",
+	     stats->sum / stats->count, percentile( stats, 0.5 ), percentile( stats, 0.95 ),
+	     stats->max, stats->count );
+  }
+}
+
+
+
+void free_metamerism( metamerism *m )
+{
+  unsigned int n;
+
+  for( n=0; n<m->illuminants-1; n++ ) free( m->stats[n].histogram );
+  free( m->stats );
+  free( m->white );
+  free( m->L );
+  free( m->a );
+  free( m->b );
+  free( m->delta );
+}
@@ -0,0 +1,74 @@
+/*
+    Metamerism map structure
+
+    Copyright (c) 2015-2024, Ruven <ruven@users.sourceforge.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+
+*/
+
+
+#ifndef METAMERISM_H
+#define METAMERISM_H
+
+
+#include <stdio.h>
+#include "weights.h"
+
+
+/* Color difference formulae
+ */
+#define DELTA_E_76 76
+#define DELTA_E_2000 2000
+
+
+/* Color differences are counted in steps of 0.01 up to 100 with a final bin for
+   anything larger
+ */
+#define DELTA_E_BINS 10001
+
+
+/* Summary of the color differences between our reference illuminant and another
+ */
+typedef struct {
+  unsigned long long count;   /* Pixels with a non-zero reference luminance */
+  double sum;
+  float max;
+  unsigned long long *histogram;
+} delta_e_stats;
+
+
+/* Metamerism map under a reference illuminant and one or more others. Each line of
+   CIE L*a*b* values is held as separate planes so that the differences are
+   calculated over contiguous arrays
+ */
+typedef struct {
+  int formula;                /* DELTA_E_76 or DELTA_E_2000 */
+  unsigned int illuminants;
+  unsigned int width;
+  double *white;              /* XYZ white point of each illuminant */
+  float *L, *a, *b;           /* Planes of width values for each illuminant */
+  float *delta;               /* Differences for the current comparison */
+  delta_e_stats *stats;       /* Statistics for each illuminant after the first */
+} metamerism;
+
+
+int create_metamerism( metamerism*, render_weights*, int, unsigned int );
+void metamerism_line( metamerism*, const float*, float* );
+void print_metamerism( metamerism*, const char**, FILE* );
+void free_metamerism( metamerism* );
+
+
+#endif
@@ -0,0 +1,1513 @@
+/*
+    Output image routines
+
+    Copyright (c) 2015-2024, Ruven <ruven@users.sourceforge.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+
+*/
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <setjmp.h>
+#include <zlib.h>
+#include <jpeglib.h>
+
+#if defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) )
+#include <immintrin.h>
+#define HAVE_F16C_DISPATCH
+#endif
+#include "output.h"
+#include "color.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#else
+#define omp_get_max_threads() 1
+#endif
+
+#include "icc.c"
+
+
+
+/* Classic TIFF offsets are 32 bit. Switch to BigTIFF before reaching 4GB, leaving
+   headroom for our directory, strip tables and for compressed data that ends up
+   larger than the raw pixels
+ */
+#define BIGTIFF_THRESHOLD 0xF0000000ULL
+
+
+
+/* Estimated uncompressed size of our output. The reduced resolutions of a pyramid
+   add up to at most a third of the full resolution image
+ */
+static uint64_t output_size( output_format *format )
+{
+  uint64_t size = (uint64_t) format->width * format->height * output_pixel_size( format );
+  if( format->pyramid ) size += size / 3;
+  return size;
+}
+
+
+
+/* Decide whether our output needs BigTIFF from its estimated uncompressed size
+ */
+int use_bigtiff( output_format *format )
+{
+  if( format->bigtiff >= 0 ) return format->bigtiff;
+  return ( output_size( format ) > BIGTIFF_THRESHOLD );
+}
+
+
+
+/* Whether we encode JPEG ourselves as YCbCr. This needs 8 bit RGB, otherwise JPEG
+   compression is left to libtiff
+ */
+static int ycbcr_jpeg( output_format *format )
+{
+  return ( format->compression == COMPRESSION_JPEG && format->bits_per_sample == 8 &&
+	   format->colorspace == PHOTOMETRIC_RGB && format->samples == 3 );
+}
+
+
+
+/* Number of samples beyond those of our photometric interpretation: any after the
+   first of a data map or an alpha channel after our color samples
+ */
+static unsigned int extra_samples( output_format *format )
+{
+  if( format->colorspace == PHOTOMETRIC_MINISBLACK ) return format->samples - 1;
+  return format->alpha ? 1 : 0;
+}
+
+
+
+/* Set the metadata tags for the current TIFF directory
+ */
+static void set_tiff_tags( TIFF *out, output_format *format )
+{
+  short sample_format = ( format->bits_per_sample == 32 || format->half_float ) ? SAMPLEFORMAT_IEEEFP : SAMPLEFORMAT_UINT;
+  uint32_t rows_per_strip;
+  int transposed = ( format->rotate == 90 || format->rotate == 270 );
+
+  /* Set basic TIFF metadata tags. Rotation by 90 or 270 degrees swaps our axes
+   */
+  TIFFSetField( out, TIFFTAG_IMAGEWIDTH, transposed ? format->height : format->width );   // set the width of the image
+  TIFFSetField( out, TIFFTAG_IMAGELENGTH, transposed ? format->width : format->height );  // set the height of the image
+  TIFFSetField( out, TIFFTAG_SAMPLESPERPIXEL, format->samples );         // set number of channels per pixel
+  TIFFSetField( out, TIFFTAG_BITSPERSAMPLE, format->bits_per_sample );   // set the size of the channels
+  TIFFSetField( out, TIFFTAG_SAMPLEFORMAT, sample_format );              // Floating point precision
+  TIFFSetField( out, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT );         // set the origin of the image.
+  TIFFSetField( out, TIFFTAG_RESOLUTIONUNIT, RESUNIT_CENTIMETER );       // set resolution to cm
+  TIFFSetField( out, TIFFTAG_XRESOLUTION, transposed ? format->y_resolution : format->x_resolution );
+  TIFFSetField( out, TIFFTAG_YRESOLUTION, transposed ? format->x_resolution : format->y_resolution );
+  if( format->tile_size > 0 ){
+    TIFFSetField( out, TIFFTAG_TILEWIDTH, format->tile_size );
+    TIFFSetField( out, TIFFTAG_TILELENGTH, format->tile_size );
+  }
+  else{
+    rows_per_strip = ( format->rows_per_strip > 0 ) ? format->rows_per_strip : TIFFDefaultStripSize( out, format->width*format->samples );
+    /* JPEG strips must hold whole rows of MCUs
+     */
+    if( ycbcr_jpeg( format ) ){
+      uint32_t mcu = 8 * format->jpeg_subsampling;
+      rows_per_strip = ( ( rows_per_strip + mcu - 1 ) / mcu ) * mcu;
+    }
+    TIFFSetField( out, TIFFTAG_ROWSPERSTRIP, rows_per_strip );
+  }
+  TIFFSetField( out, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG );
+  TIFFSetField( out, TIFFTAG_COMPRESSION, format->compression );
+  if( ycbcr_jpeg( format ) ){
+    float reference[6] = { 0.0, 255.0, 128.0, 255.0, 128.0, 255.0 };
+    TIFFSetField( out, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_YCBCR );
+    TIFFSetField( out, TIFFTAG_YCBCRSUBSAMPLING, format->jpeg_subsampling, format->jpeg_subsampling );
+    TIFFSetField( out, TIFFTAG_REFERENCEBLACKWHITE, reference );
+    TIFFSetField( out, TIFFTAG_JPEGQUALITY, format->jpeg_quality );
+  }
+  else TIFFSetField( out, TIFFTAG_PHOTOMETRIC, format->colorspace );
+  if( extra_samples( format ) > 0 ){
+    uint16_t extra[format->samples];
+    unsigned int i;
+    for( i=0; i<extra_samples( format ); i++ ) extra[i] = format->alpha ? EXTRASAMPLE_UNASSALPHA : EXTRASAMPLE_UNSPECIFIED;
+    TIFFSetField( out, TIFFTAG_EXTRASAMPLES, extra_samples( format ), extra );
+  }
+  if( format->predictor != PREDICTOR_NONE ) TIFFSetField( out, TIFFTAG_PREDICTOR, format->predictor );
+  TIFFSetField( out, TIFFTAG_SOFTWARE, "hyper2color" );
+  TIFFSetField( out, TIFFTAG_IMAGEDESCRIPTION, "Color rendering of hyperspectral image cube" );
+
+  // TIFFTAG_COLORSPACE is an EXIF field - leave for now
+  //  if( colorspace == PHOTOMETRIC_RGB ) TIFFSetField( out, TIFFTAG_COLORSPACE, 1 );
+  //  else TIFFSetField( out, TIFFTAG_COLORSPACE, 65535 );
+
+  // Set ICC profile if necessary
+  if( format->icc_profile > 0 ){
+    unsigned char* buffer = NULL;
+    size_t len;
+    if( format->icc_profile == 1 ){
+      buffer = sRGB_ICC;
+      len = sRGB_ICC_size;
+    }
+    else if( format->icc_profile == 2 ){
+      buffer = AdobeRGB_ICC;
+      len = AdobeRGB_ICC_size;
+    }
+    TIFFSetField( out, TIFFTAG_ICCPROFILE, len, buffer );
+  }
+}
+
+
+
+/* Open a TIFF output image and set its metadata tags
+ */
+TIFF* open_tiff_output( const char *filename, output_format *format )
+{
+  TIFF *out;
+
+  if( format->bigtiff == 0 && output_size( format ) > BIGTIFF_THRESHOLD ){
+    fprintf( stderr, "Warning: '%s' may exceed the 4GB limit of classic TIFF\n", filename );
+  }
+
+  if( ! ( out = TIFFOpen( filename, use_bigtiff( format ) ? "w8" : "w" ) ) ) return NULL;
+
+  set_tiff_tags( out, format );
+
+  return out;
+}
+
+
+
+/* Size in bytes of a single output pixel
+ */
+size_t output_pixel_size( output_format *format )
+{
+  return format->samples * format->bits_per_sample / 8;
+}
+
+
+
+/* Convert a float to IEEE half precision, rounding to nearest even
+ */
+static uint16_t float_to_half( float value )
+{
+  uint32_t f, sign, mantissa, half, remainder;
+  int exponent;
+
+  memcpy( &f, &value, 4 );
+  sign = ( f >> 16 ) & 0x8000;
+  exponent = (int)( ( f >> 23 ) & 0xff ) - 127 + 15;
+  mantissa = f & 0x7fffff;
+
+  /* Infinity and NaN
+   */
+  if( exponent == 0xff - 127 + 15 ) return sign | 0x7c00 | ( mantissa ? 0x200 : 0 );
+  if( exponent >= 0x1f ) return sign | 0x7c00;
+
+  /* Subnormal halves
+   */
+  if( exponent <= 0 ){
+    unsigned int shift = 14 - exponent;
+    if( shift > 24 ) return sign;
+    mantissa |= 0x800000;
+    half = mantissa >> shift;
+    remainder = mantissa & ( ( 1u << shift ) - 1 );
+    if( remainder > ( 1u << (shift-1) ) || ( remainder == ( 1u << (shift-1) ) && ( half & 1 ) ) ) half++;
+    return sign | half;
+  }
+
+  /* Rounding may carry into the exponent, which is still correct
+   */
+  half = ( exponent << 10 ) | ( mantissa >> 13 );
+  remainder = mantissa & 0x1fff;
+  if( remainder > 0x1000 || ( remainder == 0x1000 && ( half & 1 ) ) ) half++;
+  return sign | half;
+}
+
+
+
+/* Convert an IEEE half precision value to a float
+ */
+static float half_to_float( uint16_t h )
+{
+  uint32_t sign = (uint32_t)( h & 0x8000 ) << 16;
+  uint32_t exponent = ( h >> 10 ) & 0x1f;
+  uint32_t mantissa = h & 0x3ff;
+  uint32_t f;
+  float value;
+
+  if( exponent == 0 ){
+    value = mantissa / 16777216.0f;
+    return sign ? -value : value;
+  }
+  if( exponent == 0x1f ) f = sign | 0x7f800000 | ( mantissa << 13 );
+  else f = sign | ( ( exponent + 112 ) << 23 ) | ( mantissa << 13 );
+
+  memcpy( &value, &f, 4 );
+  return value;
+}
+
+
+
+#ifdef HAVE_F16C_DISPATCH
+/* Convert floats to halves 4 at a time with the F16C instruction set
+ */
+__attribute__((target("f16c")))
+static void floats_to_halves_f16c( const float *in, uint16_t *out, size_t n )
+{
+  size_t i;
+  for( i=0; i+4<=n; i+=4 ){
+    __m128i h = _mm_cvtps_ph( _mm_loadu_ps( in + i ), 0 );
+    _mm_storel_epi64( (__m128i*)( out + i ), h );
+  }
+  for( ; i<n; i++ ) out[i] = float_to_half( in[i] );
+}
+#endif
+
+
+
+/* Convert a run of floats to halves, using F16C if the processor supports it
+ */
+static void floats_to_halves( const float *in, uint16_t *out, size_t n )
+{
+  size_t i;
+#ifdef HAVE_F16C_DISPATCH
+  if( __builtin_cpu_supports( "f16c" ) ){
+    floats_to_halves_f16c( in, out, n );
+    return;
+  }
+#endif
+  for( i=0; i<n; i++ ) out[i] = float_to_half( in[i] );
+}
+
+
+
+/* Number of samples narrowed to half floats at a time
+ */
+#define HALF_BLOCK 1024
+
+
+
+/* Convert a line of CIE XYZ values to our output color space and bit depth. Outputs
+   with an alpha channel take it from alpha, from 0 for invalid to 1 for valid, or
+   are opaque if no alpha is given
+ */
+void encode_colors( output_format *format, float *XYZ, const float *alpha, void *buffer, unsigned int width )
+{
+  float matrix[3][3];
+  unsigned int spp = format->samples;
+  unsigned int i;
+
+  /* Half floats are encoded as floats and then narrowed, a block of pixels at a time
+     through a buffer on our stack
+   */
+  if( format->half_float ){
+    output_format single = *format;
+    float values[HALF_BLOCK];
+    unsigned int block = HALF_BLOCK / spp;
+    single.bits_per_sample = 32;
+    single.half_float = 0;
+    for( i=0; i<width; i+=block ){
+      unsigned int n = ( width - i < block ) ? width - i : block;
+      encode_colors( &single, XYZ + (size_t) i * 3, alpha ? alpha + i : NULL, values, n );
+      floats_to_halves( values, (uint16_t*) buffer + (size_t) i * spp, (size_t) n * spp );
+    }
+    return;
+  }
+
+  /* RGB conversion matrix adapted to the white point of our illuminant
+   */
+  if( format->colorspace == PHOTOMETRIC_RGB ) rgb_matrix( format->icc_profile, format->adaptation, matrix );
+
+  for( i=0; i<width; i++ ){
+
+    size_t o = (size_t) i * spp;
+    float XX = XYZ[i*3];
+    float YY = XYZ[i*3 + 1];
+    float ZZ = XYZ[i*3 + 2];
+
+    /* Convert to RGB (sRGB or AdobeRGB)
+     */
+    if( format->colorspace == PHOTOMETRIC_RGB ){
+
+      float RGB[3];
+      calculate_RGB( format->icc_profile, matrix, &XYZ[i*3], RGB );
+      float R = RGB[0], G = RGB[1], B = RGB[2];
+
+      if( format->bits_per_sample == 32 ){
+	((float*)buffer)[o]     = R;
+	((float*)buffer)[o + 1] = G;
+	((float*)buffer)[o + 2] = B;
+      }
+      else if( format->bits_per_sample == 16 ){
+	((unsigned short*)buffer)[o]     = (unsigned short)( R * 65535.0 );
+	((unsigned short*)buffer)[o + 1] = (unsigned short)( G * 65535.0 );
+	((unsigned short*)buffer)[o + 2] = (unsigned short)( B * 65535.0 );
+      }
+      else{
+	((unsigned char*)buffer)[o]     = (unsigned char)( R * 255.0 );
+	((unsigned char*)buffer)[o + 1] = (unsigned char)( G * 255.0 );
+	((unsigned char*)buffer)[o + 2] = (unsigned char)( B * 255.0 );
+      }
+    }
+
+    /* CIE XYZ scaled so that Y is 1.0 for a perfect white
+     */
+    else if( format->colorspace == COLORSPACE_XYZ ){
+      unsigned int c;
+      for( c=0; c<3; c++ ){
+	float v = XYZ[i*3 + c] / 100.0f;
+	if( format->bits_per_sample == 32 ) ((float*)buffer)[o + c] = v;
+	else{
+	  if( v < 0.0f ) v = 0.0f;
+	  if( v > 1.0f ) v = 1.0f;
+	  if( format->bits_per_sample == 16 ) ((unsigned short*)buffer)[o + c] = (unsigned short)( v * 65535.0 );
+	  else ((unsigned char*)buffer)[o + c] = (unsigned char)( v * 255.0 );
+	}
+      }
+    }
+
+    // CIE L*a*b* color space
+    else{
+      float L, a, b;
+      XYZ2LAB(XX,YY,ZZ,format->white,&L,&a,&b);
+
+      if( format->bits_per_sample == 8 ){
+	((unsigned char*)buffer)[o]     = (unsigned char)( L * 2.55 );
+	((unsigned char*)buffer)[o + 1] = (signed char) (a);
+	((unsigned char*)buffer)[o + 2] = (signed char) (b);
+      }
+      else if( format->bits_per_sample == 16 ){
+	((unsigned short*)buffer)[o]     = (unsigned short)( L * 655.35 );
+	((unsigned short*)buffer)[o + 1] = (signed short)( a * 255.0 );
+	((unsigned short*)buffer)[o + 2] = (signed short)( b * 255.0 );
+      }
+      else{
+	((float*)buffer)[o]     = L;
+	((float*)buffer)[o + 1] = a;
+	((float*)buffer)[o + 2] = b;
+      }
+    }
+
+    /* Alpha channel, clipped as resampling can overshoot at edges
+     */
+    if( format->alpha ){
+      float A = alpha ? alpha[i] : 1.0f;
+      if( A < 0.0f ) A = 0.0f;
+      else if( A > 1.0f ) A = 1.0f;
+      if( format->bits_per_sample == 32 ) ((float*)buffer)[o + 3] = A;
+      else if( format->bits_per_sample == 16 ) ((unsigned short*)buffer)[o + 3] = (unsigned short)( A * 65535.0 + 0.5 );
+      else ((unsigned char*)buffer)[o + 3] = (unsigned char)( A * 255.0 + 0.5 );
+    }
+  }
+}
+
+
+
+/* Apply a TIFF horizontal or floating point predictor in place to rows of pixels
+ */
+static void apply_predictor( output_format *format, unsigned char *data, unsigned int rows, unsigned int width )
+{
+  unsigned int bytes = format->bits_per_sample / 8;
+  unsigned int spp = format->samples;
+  size_t samples = (size_t) width * spp;
+  size_t row_size = samples * bytes;
+  unsigned char *tmp = NULL;
+  unsigned int r;
+  size_t i;
+
+  if( format->predictor == PREDICTOR_FLOATINGPOINT ) tmp = malloc( row_size );
+
+  for( r=0; r<rows; r++ ){
+
+    unsigned char *row = data + r*row_size;
+
+    if( format->predictor == PREDICTOR_HORIZONTAL ){
+      /* Difference each sample with the same sample of the previous pixel
+       */
+      if( bytes == 1 ){
+	for( i=samples-1; i>=spp; i-- ) row[i] -= row[i-spp];
+      }
+      else if( bytes == 2 ){
+	uint16_t *p = (uint16_t*) row;
+	for( i=samples-1; i>=spp; i-- ) p[i] -= p[i-spp];
+      }
+      else{
+	uint32_t *p = (uint32_t*) row;
+	for( i=samples-1; i>=spp; i-- ) p[i] -= p[i-spp];
+      }
+    }
+    else if( format->predictor == PREDICTOR_FLOATINGPOINT ){
+      /* Split samples into byte planes, most significant first, then difference the
+	 bytes. This matches libtiff's fpDiff on little endian machines
+       */
+      unsigned int b;
+      memcpy( tmp, row, row_size );
+      for( i=0; i<samples; i++ ){
+	for( b=0; b<bytes; b++ ) row[(bytes-b-1)*samples + i] = tmp[bytes*i + b];
+      }
+      for( i=row_size-1; i>=spp; i-- ) row[i] -= row[i-spp];
+    }
+  }
+
+  free( tmp );
+}
+
+
+
+/* Compress a tile or strip with zlib into a newly allocated buffer. Returns the
+   compressed size or 0 on failure
+ */
+static size_t deflate_chunk( unsigned char *data, size_t size, unsigned char **out, int level )
+{
+  uLongf length = compressBound( size );
+
+  *out = malloc( length );
+  if( compress2( *out, &length, data, size, level ) != Z_OK ){
+    free( *out );
+    *out = NULL;
+    return 0;
+  }
+
+  return length;
+}
+
+
+
+/* TIFF LZW codes: 9 to 12 bits wide with the first 256 codes for single bytes
+ */
+#define LZW_CLEAR 256
+#define LZW_EOI 257
+#define LZW_FIRST 258
+#define LZW_MAX 4095
+#define LZW_HASH_BITS 13
+
+typedef struct {
+  unsigned char *out;
+  size_t size;
+  uint32_t bits;              /* Pending bits, most significant first */
+  int count;                  /* Number of pending bits */
+  int width;                  /* Current code width */
+} lzw_stream;
+
+static void lzw_put( lzw_stream *s, unsigned int code )
+{
+  s->bits = ( s->bits << s->width ) | code;
+  s->count += s->width;
+  while( s->count >= 8 ){
+    s->count -= 8;
+    s->out[s->size++] = (unsigned char)( s->bits >> s->count );
+  }
+}
+
+
+
+/* Compress a tile or strip with TIFF LZW into a newly allocated buffer. Codes widen
+   and the table is cleared at the same points as in libtiff's encoder, which allows
+   for the decoder adding each entry one code later than we do. Returns the
+   compressed size
+ */
+static size_t lzw_chunk( unsigned char *data, size_t size, unsigned char **out )
+{
+  uint32_t *keys = calloc( 1 << LZW_HASH_BITS, sizeof(uint32_t) );
+  uint16_t *codes = malloc( sizeof(uint16_t) << LZW_HASH_BITS );
+  lzw_stream s = { NULL, 0, 0, 0, 9 };
+  unsigned int next = LZW_FIRST, current;
+  size_t i;
+
+  /* Each code covers at least one byte, plus our clear and end codes
+   */
+  s.out = malloc( size + size/2 + size/1024 + 16 );
+  *out = s.out;
+
+  lzw_put( &s, LZW_CLEAR );
+
+  if( size > 0 ){
+    current = data[0];
+    for( i=1; i<size; i++ ){
+
+      uint32_t key = ( ( current << 8 ) | data[i] ) + 1;
+      uint32_t h = ( key * 2654435761u ) >> ( 32 - LZW_HASH_BITS );
+
+      while( keys[h] && keys[h] != key ) h = ( h + 1 ) & ( ( 1 << LZW_HASH_BITS ) - 1 );
+      if( keys[h] ){
+	current = codes[h];
+	continue;
+      }
+
+      lzw_put( &s, current );
+      keys[h] = key;
+      codes[h] = next++;
+      current = data[i];
+
+      if( next == LZW_MAX - 1 ){
+	lzw_put( &s, LZW_CLEAR );
+	memset( keys, 0, sizeof(uint32_t) << LZW_HASH_BITS );
+	next = LZW_FIRST;
+	s.width = 9;
+      }
+      else if( next > ( 1u << s.width ) - 1 ) s.width++;
+    }
+
+    /* The decoder adds an entry on reading our final code, which may widen the end code
+     */
+    lzw_put( &s, current );
+    if( ++next == LZW_MAX - 1 ){
+      lzw_put( &s, LZW_CLEAR );
+      s.width = 9;
+    }
+    else if( next > ( 1u << s.width ) - 1 ) s.width++;
+  }
+
+  lzw_put( &s, LZW_EOI );
+  if( s.count > 0 ) s.out[s.size++] = (unsigned char)( s.bits << ( 8 - s.count ) );
+
+  free( keys );
+  free( codes );
+
+  return s.size;
+}
+
+
+
+/* Error handler for libjpeg that returns control to our encoder instead of exiting
+ */
+typedef struct {
+  struct jpeg_error_mgr pub;
+  jmp_buf jump;
+} jpeg_error;
+
+static void jpeg_error_exit( j_common_ptr cinfo )
+{
+  longjmp( ((jpeg_error*) cinfo->err)->jump, 1 );
+}
+
+
+
+/* Compress a tile or strip of 8 bit RGB as a self-contained YCbCr JPEG stream into
+   a newly allocated buffer. libjpeg handles the color conversion and subsampling.
+   Returns the compressed size or 0 on failure
+ */
+static size_t jpeg_chunk( output_format *format, unsigned char *data, unsigned int width, unsigned int rows,
+			  unsigned char **out )
+{
+  struct jpeg_compress_struct cinfo;
+  jpeg_error jerr;
+  unsigned long size = 0;
+  unsigned int r;
+
+  *out = NULL;
+  cinfo.err = jpeg_std_error( &jerr.pub );
+  jerr.pub.error_exit = jpeg_error_exit;
+  if( setjmp( jerr.jump ) ){
+    jpeg_destroy_compress( &cinfo );
+    free( *out );
+    *out = NULL;
+    return 0;
+  }
+
+  jpeg_create_compress( &cinfo );
+  jpeg_mem_dest( &cinfo, out, &size );
+
+  cinfo.image_width = width;
+  cinfo.image_height = rows;
+  cinfo.input_components = 3;
+  cinfo.in_color_space = JCS_RGB;
+  jpeg_set_defaults( &cinfo );
+  jpeg_set_quality( &cinfo, format->jpeg_quality, TRUE );
+  cinfo.comp_info[0].h_samp_factor = format->jpeg_subsampling;
+  cinfo.comp_info[0].v_samp_factor = format->jpeg_subsampling;
+  cinfo.write_JFIF_header = FALSE;
+  cinfo.write_Adobe_marker = FALSE;
+
+  jpeg_start_compress( &cinfo, TRUE );
+  for( r=0; r<rows; r++ ){
+    JSAMPROW row = data + (size_t) r * width * 3;
+    jpeg_write_scanlines( &cinfo, &row, 1 );
+  }
+  jpeg_finish_compress( &cinfo );
+  jpeg_destroy_compress( &cinfo );
+
+  return size;
+}
+
+
+
+/* Encode a tile or strip of rows into our list of chunks. The chunk is either
+   taken over or freed
+ */
+static void encode_chunk( output_writer *w, unsigned int t, unsigned char *chunk,
+			  unsigned int rows, unsigned int width )
+{
+  size_t size = (size_t) rows * width * output_pixel_size( &w->format );
+
+  if( w->format.compression == COMPRESSION_ADOBE_DEFLATE ){
+    if( w->format.predictor != PREDICTOR_NONE ) apply_predictor( &w->format, chunk, rows, width );
+    w->chunk_size[t] = deflate_chunk( chunk, size, &w->chunk[t], w->format.deflate_level );
+    free( chunk );
+  }
+  else if( w->format.compression == COMPRESSION_LZW ){
+    if( w->format.predictor != PREDICTOR_NONE ) apply_predictor( &w->format, chunk, rows, width );
+    w->chunk_size[t] = lzw_chunk( chunk, size, &w->chunk[t] );
+    free( chunk );
+  }
+  else if( ycbcr_jpeg( &w->format ) ){
+    w->chunk_size[t] = jpeg_chunk( &w->format, chunk, width, rows, &w->chunk[t] );
+    free( chunk );
+  }
+  else{
+    w->chunk[t] = chunk;
+    w->chunk_size[t] = size;
+  }
+}
+
+
+
+/* Write our encoded chunks in order, where chunk t is tile or strip first + t*step
+ */
+static int write_chunks( output_writer *w, unsigned int chunks, uint32_t first, uint32_t step )
+{
+  unsigned int tiled = ( w->format.tile_size > 0 );
+  int raw = ( w->format.compression == COMPRESSION_ADOBE_DEFLATE || w->format.compression == COMPRESSION_LZW ||
+	      w->format.compression == COMPRESSION_NONE || ycbcr_jpeg( &w->format ) );
+  unsigned int t;
+  int status = 0;
+
+  for( t=0; t<chunks; t++ ){
+    uint32_t index = first + t*step;
+    tmsize_t written;
+    if( raw ){
+      if( !w->chunk[t] ) written = -1;
+      else if( tiled ) written = TIFFWriteRawTile( w->tiff, index, w->chunk[t], w->chunk_size[t] );
+      else written = TIFFWriteRawStrip( w->tiff, index, w->chunk[t], w->chunk_size[t] );
+    }
+    else if( tiled ) written = TIFFWriteEncodedTile( w->tiff, index, w->chunk[t], w->chunk_size[t] );
+    else written = TIFFWriteEncodedStrip( w->tiff, index, w->chunk[t], w->chunk_size[t] );
+    if( written == -1 ) status = 1;
+    free( w->chunk[t] );
+    w->chunk[t] = NULL;
+  }
+
+  return status;
+}
+
+
+
+/* Write out our buffered block as a row of tiles or a run of strips. Chunks are cut
+   out of the block and, for deflate, LZW and YCbCr JPEG compression, compressed in
+   parallel before being written in order. Other codecs are left to libtiff
+ */
+static int flush_block( output_writer *w )
+{
+  size_t pixel_size = output_pixel_size( &w->format );
+  unsigned int tiled = ( w->format.tile_size > 0 );
+  unsigned int chunk_width = tiled ? w->format.tile_size : w->format.width;
+  size_t stride = (size_t) w->chunks * chunk_width * pixel_size;
+  unsigned int chunks = tiled ? w->chunks : ( w->buffered + w->chunk_rows - 1 ) / w->chunk_rows;
+  uint32_t first;
+  int t, status;
+
+  /* Rotation by 180 degrees fills our image from the bottom up
+   */
+  if( w->format.rotate == 180 ) first = ( w->format.height - w->row ) / w->chunk_rows;
+  else first = ( w->row - w->buffered ) / w->chunk_rows;
+
+#pragma omp parallel for
+  for( t=0; t<(int)chunks; t++ ){
+
+    unsigned int rows = w->chunk_rows;
+    unsigned char *chunk;
+    unsigned int r;
+
+    /* Tiles are always complete, but the final strip may be short
+     */
+    if( tiled ){
+      chunk = malloc( (size_t) rows * chunk_width * pixel_size );
+      for( r=0; r<rows; r++ ){
+	memcpy( chunk + r*chunk_width*pixel_size, w->block + r*stride + (size_t)t*chunk_width*pixel_size,
+		chunk_width*pixel_size );
+      }
+    }
+    else{
+      if( (t+1)*rows > w->buffered ) rows = w->buffered - t*rows;
+      chunk = malloc( (size_t) rows * stride );
+      memcpy( chunk, w->block + (size_t)t*w->chunk_rows*stride, (size_t) rows * stride );
+    }
+
+    encode_chunk( w, t, chunk, rows, chunk_width );
+  }
+
+  status = write_chunks( w, chunks, tiled ? first * w->chunks : first, 1 );
+
+  /* Clear our block so that padding in the final row of tiles is zero
+   */
+  memset( w->block, 0, (size_t) w->block_rows * stride );
+  w->buffered = 0;
+
+  return status;
+}
+
+
+
+/* Encode and write a block of scanlines rotated by 90 or 270 degrees, which
+   becomes a single column of tiles. Each tile is transposed from the block in
+   small squares so that both the scanlines read and the tile rows written stay
+   within cache
+ */
+#define TRANSPOSE_BLOCK 16
+
+static int flush_column( output_writer *w, unsigned int column )
+{
+  size_t pixel_size = output_pixel_size( &w->format );
+  unsigned int tile = w->format.tile_size;
+  unsigned int tiles = ( w->format.width + tile - 1 ) / tile;
+  int t, status;
+
+#pragma omp parallel for
+  for( t=0; t<(int)tiles; t++ ){
+
+    unsigned char *chunk = calloc( (size_t) tile * tile, pixel_size );
+    unsigned int x0, y0, x, y;
+
+    /* Each tile row y is the scanline sample at t*tile + y, or counted from the
+       end of the scanline for 270 degrees, and each tile column x is a scanline
+     */
+    for( y0=0; y0<tile; y0+=TRANSPOSE_BLOCK ){
+      for( x0=0; x0<tile; x0+=TRANSPOSE_BLOCK ){
+	for( y=y0; y<y0+TRANSPOSE_BLOCK; y++ ){
+	  unsigned int sample = t*tile + y;
+	  if( sample >= w->format.width ) break;
+	  if( w->format.rotate == 270 ) sample = w->format.width - 1 - sample;
+	  for( x=x0; x<x0+TRANSPOSE_BLOCK; x++ ){
+	    memcpy( chunk + ( (size_t)y*tile + x ) * pixel_size,
+		    w->block + x*w->line_size + (size_t)sample*pixel_size, pixel_size );
+	  }
+	}
+      }
+    }
+
+    encode_chunk( w, t, chunk, tile, tile );
+  }
+
+  /* Tiles are numbered across our rotated image
+   */
+  status = write_chunks( w, tiles, column, w->chunks );
+
+  memset( w->block, 0, (size_t) tile * w->line_size );
+  w->buffered = 0;
+
+  return status;
+}
+
+
+
+/* TIFF directory under construction for direct output. Values too large to fit
+   within an entry are placed in an area following the directory
+ */
+typedef struct {
+  int big;                    /* BigTIFF layout */
+  unsigned char *ifd;
+  size_t ifd_size;
+  unsigned int entries;
+  unsigned char *extra;
+  size_t extra_size;
+  uint64_t extra_offset;      /* File offset of our extra area */
+} tiff_directory;
+
+
+
+/* Add an entry to our directory. Entries must be added in ascending tag order
+ */
+static void add_tiff_entry( tiff_directory *d, uint16_t tag, uint16_t type, uint64_t count, const void *data )
+{
+  static const unsigned int type_size[] = { 0, 1, 1, 2, 4, 8, 1, 1, 2, 4, 8, 4, 8, 4, 0, 0, 8, 8, 8 };
+  size_t inline_size = d->big ? 8 : 4;
+  size_t size = count * type_size[type];
+  unsigned char *entry = d->ifd + ( d->big ? 8 + d->entries*20 : 2 + d->entries*12 );
+  unsigned char *value = entry + ( d->big ? 12 : 8 );
+
+  memcpy( entry, &tag, 2 );
+  memcpy( entry + 2, &type, 2 );
+  if( d->big ) memcpy( entry + 4, &count, 8 );
+  else{
+    uint32_t count32 = count;
+    memcpy( entry + 4, &count32, 4 );
+  }
+
+  if( size <= inline_size ) memcpy( value, data, size );
+  else{
+    /* Keep values word aligned
+     */
+    uint64_t offset = d->extra_offset + d->extra_size;
+    d->extra = realloc( d->extra, d->extra_size + size + 1 );
+    memcpy( d->extra + d->extra_size, data, size );
+    d->extra[d->extra_size + size] = 0;
+    d->extra_size += size + ( size & 1 );
+    if( d->big ) memcpy( value, &offset, 8 );
+    else{
+      uint32_t offset32 = offset;
+      memcpy( value, &offset32, 4 );
+    }
+  }
+
+  d->entries++;
+}
+
+
+
+/* Convert a resolution to a TIFF rational
+ */
+static void tiff_rational( double value, uint32_t *rational )
+{
+  rational[1] = ( value == floor( value ) ) ? 1 : 10000;
+  rational[0] = (uint32_t) floor( value * rational[1] + 0.5 );
+}
+
+
+
+/* Open an uncompressed stripped TIFF for direct output. We write the header and
+   directory ourselves up front with the strips laid out contiguously after them,
+   so that each scanline has a fixed offset and can be written with pwrite from any
+   thread in any order
+ */
+static int open_direct_output( output_writer *w, const char *filename )
+{
+  output_format *format = &w->format;
+  tiff_directory d;
+  uint32_t rows_per_strip, strips, s;
+  uint16_t spp = format->samples, bits[spp], sample_format[spp], extra[spp], one = 1, planar = PLANARCONFIG_CONTIG;
+  uint16_t compression = COMPRESSION_NONE, orientation = ORIENTATION_TOPLEFT, unit = RESUNIT_CENTIMETER;
+  uint32_t width = format->width, height = format->height, xres[2], yres[2];
+  void *offsets, *counts;
+  const char *software = "hyper2color";
+  const char *description = "Color rendering of hyperspectral image cube";
+  unsigned char *icc = NULL;
+  size_t icc_size = 0;
+  unsigned char header[16] = { 0 };
+  uint64_t data_offset;
+  int fd;
+
+  /* Our strips are contiguous, so their size only affects the size of the strip tables
+   */
+  rows_per_strip = format->rows_per_strip;
+  if( rows_per_strip == 0 ) rows_per_strip = ( w->line_size < 8192 ) ? 8192 / w->line_size : 1;
+  if( rows_per_strip > format->height ) rows_per_strip = format->height;
+  strips = ( format->height + rows_per_strip - 1 ) / rows_per_strip;
+
+  if( format->icc_profile == 1 ){
+    icc = sRGB_ICC;
+    icc_size = sRGB_ICC_size;
+  }
+  else if( format->icc_profile == 2 ){
+    icc = AdobeRGB_ICC;
+    icc_size = AdobeRGB_ICC_size;
+  }
+
+  /* Lay out our header, directory, out of line values and finally our pixels
+   */
+  memset( &d, 0, sizeof(d) );
+  d.big = use_bigtiff( format );
+  unsigned int extra_count = extra_samples( format );
+  unsigned int entries = 17 + ( icc ? 1 : 0 ) + ( extra_count ? 1 : 0 );
+  d.ifd_size = d.big ? 8 + entries*20 + 8 : 2 + entries*12 + 4;
+  d.ifd = calloc( 1, d.ifd_size );
+  d.extra_offset = ( d.big ? 16 : 8 ) + d.ifd_size;
+
+  /* Our pixels start after an upper bound on the size of our out of line values
+   */
+  data_offset = d.extra_offset + 16 + 3*2*spp + strlen(description) + strlen(software) + 2*8 + icc_size +
+    (uint64_t) strips * ( d.big ? 16 : 8 ) + 16;
+  data_offset = ( data_offset + 15 ) & ~(uint64_t)15;
+
+  /* Strip tables are 64 bit for BigTIFF and 32 bit for classic TIFF
+   */
+  offsets = malloc( strips * sizeof(uint64_t) );
+  counts = malloc( strips * sizeof(uint64_t) );
+  for( s=0; s<strips; s++ ){
+    uint32_t rows = ( (s+1)*rows_per_strip > format->height ) ? format->height - s*rows_per_strip : rows_per_strip;
+    uint64_t offset = data_offset + (uint64_t) s * rows_per_strip * w->line_size;
+    uint64_t count = (uint64_t) rows * w->line_size;
+    if( d.big ){
+      ((uint64_t*)offsets)[s] = offset;
+      ((uint64_t*)counts)[s] = count;
+    }
+    else{
+      ((uint32_t*)offsets)[s] = offset;
+      ((uint32_t*)counts)[s] = count;
+    }
+  }
+
+  for( s=0; s<spp; s++ ){
+    bits[s] = format->bits_per_sample;
+    sample_format[s] = ( format->bits_per_sample == 32 || format->half_float ) ? SAMPLEFORMAT_IEEEFP : SAMPLEFORMAT_UINT;
+    extra[s] = format->alpha ? EXTRASAMPLE_UNASSALPHA : EXTRASAMPLE_UNSPECIFIED;
+  }
+  tiff_rational( format->x_resolution, xres );
+  tiff_rational( format->y_resolution, yres );
+  uint16_t offset_type = d.big ? 16 : 4;
+
+  add_tiff_entry( &d, TIFFTAG_IMAGEWIDTH, 4, 1, &width );
+  add_tiff_entry( &d, TIFFTAG_IMAGELENGTH, 4, 1, &height );
+  add_tiff_entry( &d, TIFFTAG_BITSPERSAMPLE, 3, spp, bits );
+  add_tiff_entry( &d, TIFFTAG_COMPRESSION, 3, 1, &compression );
+  add_tiff_entry( &d, TIFFTAG_PHOTOMETRIC, 3, 1, &format->colorspace );
+  add_tiff_entry( &d, TIFFTAG_IMAGEDESCRIPTION, 2, strlen(description) + 1, description );
+  add_tiff_entry( &d, TIFFTAG_STRIPOFFSETS, offset_type, strips, offsets );
+  add_tiff_entry( &d, TIFFTAG_ORIENTATION, 3, 1, &orientation );
+  add_tiff_entry( &d, TIFFTAG_SAMPLESPERPIXEL, 3, 1, &spp );
+  add_tiff_entry( &d, TIFFTAG_ROWSPERSTRIP, 4, 1, &rows_per_strip );
+  add_tiff_entry( &d, TIFFTAG_STRIPBYTECOUNTS, offset_type, strips, counts );
+  add_tiff_entry( &d, TIFFTAG_XRESOLUTION, 5, 1, xres );
+  add_tiff_entry( &d, TIFFTAG_YRESOLUTION, 5, 1, yres );
+  add_tiff_entry( &d, TIFFTAG_PLANARCONFIG, 3, 1, &planar );
+  add_tiff_entry( &d, TIFFTAG_RESOLUTIONUNIT, 3, 1, &unit );
+  add_tiff_entry( &d, TIFFTAG_SOFTWARE, 2, strlen(software) + 1, software );
+  if( extra_count ) add_tiff_entry( &d, TIFFTAG_EXTRASAMPLES, 3, extra_count, extra );
+  add_tiff_entry( &d, TIFFTAG_SAMPLEFORMAT, 3, spp, sample_format );
+  if( icc ) add_tiff_entry( &d, TIFFTAG_ICCPROFILE, 7, icc_size, icc );
+
+  /* Entry count at the start of our directory. The offset to the next directory
+     at the end stays zero
+   */
+  if( d.big ){
+    uint64_t n = entries;
+    memcpy( d.ifd, &n, 8 );
+  }
+  else{
+    uint16_t n = entries;
+    memcpy( d.ifd, &n, 2 );
+  }
+
+  /* Header in our native byte order
+   */
+  memcpy( header, ( *(unsigned char*) &one ) ? "II" : "MM", 2 );
+  if( d.big ){
+    uint16_t version = 43, size = 8, zero = 0;
+    uint64_t first = 16;
+    memcpy( header + 2, &version, 2 );
+    memcpy( header + 4, &size, 2 );
+    memcpy( header + 6, &zero, 2 );
+    memcpy( header + 8, &first, 8 );
+  }
+  else{
+    uint16_t version = 42;
+    uint32_t first = 8;
+    memcpy( header + 2, &version, 2 );
+    memcpy( header + 4, &first, 4 );
+  }
+
+  int status = 1;
+  if( ( fd = open( filename, O_WRONLY | O_CREAT | O_TRUNC, 0644 ) ) != -1 ){
+    uint64_t end = data_offset + (uint64_t) format->height * w->line_size;
+    if( pwrite( fd, header, d.big ? 16 : 8, 0 ) == ( d.big ? 16 : 8 ) &&
+	pwrite( fd, d.ifd, d.ifd_size, d.extra_offset - d.ifd_size ) == (ssize_t) d.ifd_size &&
+	pwrite( fd, d.extra, d.extra_size, d.extra_offset ) == (ssize_t) d.extra_size &&
+	ftruncate( fd, end ) == 0 ){
+      w->fd = fd;
+      w->data_offset = data_offset;
+      status = 0;
+    }
+    else{
+      close( fd );
+      unlink( filename );
+    }
+  }
+
+  free( offsets );
+  free( counts );
+  free( d.ifd );
+  free( d.extra );
+
+  return status;
+}
+
+
+
+/* Mirror a scanline left to right in place
+ */
+static void mirror_line( void *line, unsigned int width, size_t pixel_size )
+{
+  unsigned char *a = line, *b = a + (size_t)( width - 1 ) * pixel_size;
+  unsigned char swap[16];
+
+  while( a < b ){
+    memcpy( swap, a, pixel_size );
+    memcpy( a, b, pixel_size );
+    memcpy( b, swap, pixel_size );
+    a += pixel_size;
+    b -= pixel_size;
+  }
+}
+
+
+
+/* Average a pair of scanlines down to a single scanline of half the width. The
+   last column and, in close_output, the last row are repeated for odd sizes. CIELAB
+   a* and b* are signed
+ */
+static void reduce_lines( output_format *format, void *a, void *b, void *out )
+{
+  unsigned int width = ( format->width + 1 ) / 2;
+  int lab = ( format->colorspace == PHOTOMETRIC_CIELAB );
+  unsigned int spp = format->samples;
+  unsigned int i, c;
+
+  for( i=0; i<width; i++ ){
+    size_t x0 = (size_t) 2*i*spp;
+    size_t x1 = ( 2*i+1 < format->width ) ? x0 + spp : x0;
+    for( c=0; c<spp; c++ ){
+      size_t o = (size_t) i*spp + c;
+      if( format->bits_per_sample == 32 ){
+	float *p = a, *q = b;
+	((float*)out)[o] = ( p[x0+c] + p[x1+c] + q[x0+c] + q[x1+c] ) / 4.0f;
+      }
+      else if( format->half_float ){
+	uint16_t *p = a, *q = b;
+	((uint16_t*)out)[o] = float_to_half( ( half_to_float( p[x0+c] ) + half_to_float( p[x1+c] ) +
+					       half_to_float( q[x0+c] ) + half_to_float( q[x1+c] ) ) / 4.0f );
+      }
+      else if( format->bits_per_sample == 16 ){
+	if( lab && c > 0 ){
+	  int16_t *p = a, *q = b;
+	  ((int16_t*)out)[o] = (int16_t) floor( ( p[x0+c] + p[x1+c] + q[x0+c] + q[x1+c] + 2 ) / 4.0 );
+	}
+	else{
+	  uint16_t *p = a, *q = b;
+	  ((uint16_t*)out)[o] = (uint16_t)( ( p[x0+c] + p[x1+c] + q[x0+c] + q[x1+c] + 2 ) / 4 );
+	}
+      }
+      else{
+	if( lab && c > 0 ){
+	  int8_t *p = a, *q = b;
+	  ((int8_t*)out)[o] = (int8_t) floor( ( p[x0+c] + p[x1+c] + q[x0+c] + q[x1+c] + 2 ) / 4.0 );
+	}
+	else{
+	  uint8_t *p = a, *q = b;
+	  ((uint8_t*)out)[o] = (uint8_t)( ( p[x0+c] + p[x1+c] + q[x0+c] + q[x1+c] + 2 ) / 4 );
+	}
+      }
+    }
+  }
+}
+
+
+
+/* Open a writer for the next, half size, level of a pyramid. Each level is streamed
+   to its own temporary tiled TIFF alongside our output and appended to it on close
+ */
+static output_writer* open_pyramid_level( output_writer *w, const char *filename )
+{
+  output_format format = w->format;
+  output_writer *next;
+  char *name;
+  int fd;
+
+  format.width = ( format.width + 1 ) / 2;
+  format.height = ( format.height + 1 ) / 2;
+  format.x_resolution /= 2.0;
+  format.y_resolution /= 2.0;
+  format.bigtiff = -1;
+  format.pyramid = 0;
+  format.flip = 0;            /* Our scanlines arrive already mirrored */
+
+  name = malloc( strlen(filename) + 32 );
+  sprintf( name, "%s.%u.XXXXXX", filename, w->level + 1 );
+  if( ( fd = mkstemp( name ) ) == -1 ){
+    free( name );
+    return NULL;
+  }
+  close( fd );
+
+  if( ! ( next = open_output( name, &format ) ) ){
+    unlink( name );
+    free( name );
+    return NULL;
+  }
+  next->filename = name;
+  next->level = w->level + 1;
+
+  return next;
+}
+
+
+
+/* Open an output image for writing. Tiled images and deflate, LZW and JPEG compressed
+   stripped images are written a block at a time, with all the tiles or strips in a block
+   encoded in parallel
+ */
+output_writer* open_output( const char *filename, output_format *format )
+{
+  output_writer *w = calloc( 1, sizeof(output_writer) );
+  uint32_t rows_per_strip = 0;
+  int direct, transposed;
+
+  if( format->type < 0 ) format->type = output_type_from_filename( filename );
+
+  if( format->rotate != 90 && format->rotate != 180 && format->rotate != 270 ) format->rotate = 0;
+  if( format->rotate && format->type != OUTPUT_TIFF ){
+    fprintf( stderr, "Rotation is only available for TIFF output\n" );
+    free( w );
+    return NULL;
+  }
+  transposed = ( format->rotate == 90 || format->rotate == 270 );
+
+  /* Lightweight writers for other file types
+   */
+  if( format->type != OUTPUT_TIFF ){
+    w->fd = -1;
+    if( open_stream_output( w, filename, format ) != 0 ){
+      free( w );
+      return NULL;
+    }
+    return w;
+  }
+
+  if( format->colorspace == COLORSPACE_XYZ ){
+    fprintf( stderr, "CIE XYZ output is only available for raw, PFM or NPY files\n" );
+    free( w );
+    return NULL;
+  }
+
+  if( strcmp( filename, "-" ) == 0 ){
+    fprintf( stderr, "TIFF output cannot be written to standard output\n" );
+    free( w );
+    return NULL;
+  }
+
+  /* Pyramids are always tiled
+   */
+  if( format->pyramid && format->tile_size == 0 ) format->tile_size = 256;
+
+  /* Uncompressed stripped images are written directly, bypassing libtiff, as long
+     as their offsets fit. Other rotated images are written as tiles out of order
+   */
+  direct = ( format->compression == COMPRESSION_NONE && format->tile_size == 0 && !format->pyramid && !transposed &&
+	     ( use_bigtiff( format ) || output_size( format ) < BIGTIFF_THRESHOLD ) );
+  if( format->rotate && !direct && format->tile_size == 0 ) format->tile_size = 256;
+
+  /* Predictors only apply to compressed data and the floating point
+     predictor only to floating point samples
+   */
+  if( format->compression != COMPRESSION_ADOBE_DEFLATE && format->compression != COMPRESSION_LZW ){
+    format->predictor = PREDICTOR_NONE;
+  }
+  if( format->predictor == PREDICTOR_FLOATINGPOINT && format->bits_per_sample != 32 && !format->half_float ){
+    format->predictor = PREDICTOR_HORIZONTAL;
+  }
+
+  /* JPEG quality from 1 to 100 and subsampling of either 4:2:0 or 4:4:4
+   */
+  if( format->jpeg_quality < 1 || format->jpeg_quality > 100 ) format->jpeg_quality = 75;
+  if( format->jpeg_subsampling != 1 ) format->jpeg_subsampling = 2;
+
+  w->format = *format;
+  w->line_size = output_pixel_size( format ) * format->width;
+  w->fd = -1;
+
+  if( direct ){
+    if( open_direct_output( w, filename ) != 0 ){
+      free( w );
+      return NULL;
+    }
+    w->direct = 1;
+    return w;
+  }
+
+  if( ! ( w->tiff = open_tiff_output( filename, format ) ) ){
+    free( w );
+    return NULL;
+  }
+
+  if( format->tile_size > 0 ){
+    w->chunk_rows = format->tile_size;
+    w->block_rows = format->tile_size;
+    w->chunks = ( ( transposed ? format->height : format->width ) + format->tile_size - 1 ) / format->tile_size;
+  }
+  else if( format->compression == COMPRESSION_ADOBE_DEFLATE || format->compression == COMPRESSION_LZW ||
+	   ycbcr_jpeg( format ) ){
+    /* Buffer several strips per thread so that each thread has work
+     */
+    TIFFGetField( w->tiff, TIFFTAG_ROWSPERSTRIP, &rows_per_strip );
+    w->chunk_rows = rows_per_strip;
+    w->chunks = 1;
+    w->block_rows = rows_per_strip * 4 * omp_get_max_threads();
+    if( w->block_rows > format->height ) w->block_rows = format->height;
+  }
+
+  if( w->block_rows > 0 ){
+    unsigned int chunks = ( w->block_rows + w->chunk_rows - 1 ) / w->chunk_rows;
+    size_t width = (size_t) w->chunks * ( format->tile_size ? format->tile_size : format->width );
+    /* A column of tiles is built from a block of whole scanlines
+     */
+    if( transposed ){
+      chunks = ( format->width + format->tile_size - 1 ) / format->tile_size;
+      width = format->width;
+    }
+    if( w->chunks > chunks ) chunks = w->chunks;
+    w->block = calloc( (size_t) w->block_rows * width, output_pixel_size( format ) );
+    w->chunk = calloc( chunks, sizeof(unsigned char*) );
+    w->chunk_size = calloc( chunks, sizeof(size_t) );
+  }
+
+  /* Add levels to our pyramid until the smallest fits within a single tile
+   */
+  if( format->pyramid ){
+    output_writer *level;
+    for( level = w; level->format.width > format->tile_size || level->format.height > format->tile_size;
+	 level = level->next ){
+      level->pending = malloc( level->line_size );
+      level->reduced = malloc( output_pixel_size( format ) * ( ( level->format.width + 1 ) / 2 ) );
+      if( ! ( level->next = open_pyramid_level( level, filename ) ) ){
+	close_output( w );
+	return NULL;
+      }
+    }
+  }
+
+  return w;
+}
+
+
+
+/* Write a scanline at an arbitrary row of a direct output image. This may be called
+   concurrently from several threads for different rows
+ */
+int write_output_row( output_writer *w, void *line, unsigned int row )
+{
+  size_t written = 0;
+  ssize_t n;
+
+  if( !w->direct ) return ( row == w->row ) ? write_output_line( w, line ) : 1;
+
+  /* Mirrored and upside down rows are reversed in place
+   */
+  if( w->format.flip != ( w->format.rotate == 180 ) ){
+    mirror_line( line, w->format.width, output_pixel_size( &w->format ) );
+  }
+  if( w->format.rotate == 180 ) row = w->format.height - 1 - row;
+
+  /* PFM rows run from the bottom up
+   */
+  if( w->format.type == OUTPUT_PFM ) row = w->format.height - 1 - row;
+
+  while( written < w->line_size ){
+    n = pwrite( w->fd, (unsigned char*) line + written, w->line_size - written,
+		(off_t)( w->data_offset + (uint64_t) row * w->line_size + written ) );
+    if( n <= 0 ) return 1;
+    written += n;
+  }
+
+  return 0;
+}
+
+
+
+/* Write the next scanline of our output image. Mirrored scanlines are reversed in place
+ */
+int write_output_line( output_writer *w, void *line )
+{
+  size_t pixel_size = output_pixel_size( &w->format );
+  unsigned int position, flush;
+
+  if( w->format.type != OUTPUT_TIFF ){
+    if( w->format.flip && !w->direct ) mirror_line( line, w->format.width, pixel_size );
+    return write_stream_line( w, line );
+  }
+
+  if( w->direct ){
+    if( write_output_row( w, line, w->row ) ) return 1;
+    w->row++;
+    return 0;
+  }
+
+  if( w->format.flip ) mirror_line( line, w->format.width, pixel_size );
+
+  if( w->block_rows == 0 ){
+    if( TIFFWriteScanline( w->tiff, line, w->row, 0 ) == -1 ) return 1;
+    w->row++;
+    return 0;
+  }
+
+  /* Buffer rows until we have a complete block. Rotated by 90 or 270 degrees, each
+     scanline is a column of the block's tiles and, rotated by 180 degrees, a reversed
+     row filled from the bottom of the block
+   */
+  if( w->format.rotate == 90 || w->format.rotate == 270 ){
+    unsigned int column = ( w->format.rotate == 90 ) ? w->format.height - 1 - w->row : w->row;
+    position = column % w->block_rows;
+    memcpy( w->block + position * w->line_size, line, w->line_size );
+    flush = ( w->format.rotate == 90 ) ? ( position == 0 ) :
+      ( position == w->block_rows - 1 || w->row == w->format.height - 1 );
+  }
+  else{
+    size_t stride = (size_t) w->chunks * ( w->format.tile_size ? w->format.tile_size : w->format.width ) * pixel_size;
+    if( w->format.rotate == 180 ){
+      unsigned char *out;
+      unsigned int i;
+      position = ( w->format.height - 1 - w->row ) % w->block_rows;
+      out = w->block + position * stride;
+      for( i=0; i<w->format.width; i++ ){
+	memcpy( out + (size_t)i*pixel_size, (unsigned char*) line + (size_t)( w->format.width - 1 - i ) * pixel_size,
+		pixel_size );
+      }
+      flush = ( position == 0 );
+    }
+    else{
+      memcpy( w->block + w->buffered * stride, line, w->line_size );
+      flush = ( w->buffered + 1 == w->block_rows || w->row + 1 == w->format.height );
+    }
+  }
+  w->buffered++;
+  w->row++;
+
+  /* Feed each pair of rows, halved, into the next level of our pyramid
+   */
+  if( w->next ){
+    if( w->row % 2 ) memcpy( w->pending, line, w->line_size );
+    else{
+      reduce_lines( &w->format, w->pending, line, w->reduced );
+      if( write_output_line( w->next, w->reduced ) ) return 1;
+    }
+  }
+
+  if( flush ){
+    if( w->format.rotate == 90 || w->format.rotate == 270 ){
+      return flush_column( w, ( ( w->format.rotate == 90 ) ? w->format.height - w->row : w->row - 1 ) / w->block_rows );
+    }
+    return flush_block( w );
+  }
+
+  return 0;
+}
+
+
+
+/* Flush any remaining rows of a writer and of each level of its pyramid
+ */
+static int finish_output( output_writer *w )
+{
+  int status = 0;
+
+  /* Rotated blocks are only complete at their final scanline
+   */
+  if( w->buffered > 0 && w->format.rotate == 0 ) status = flush_block( w );
+
+  if( w->next ){
+    if( w->row % 2 ){
+      reduce_lines( &w->format, w->pending, w->pending, w->reduced );
+      status |= write_output_line( w->next, w->reduced );
+    }
+    status |= finish_output( w->next );
+  }
+
+  return status;
+}
+
+
+
+/* Append a finished pyramid level to our output as a new reduced resolution
+   directory by copying its already compressed tiles
+ */
+static int append_pyramid_level( TIFF *out, output_writer *level )
+{
+  TIFF *in;
+  uint64_t *sizes;
+  uint32_t count;
+  void *tables;
+  ttile_t t, tiles;
+  int status = 0;
+
+  if( ! ( in = TIFFOpen( level->filename, "r" ) ) ) return 1;
+
+  if( !TIFFWriteDirectory( out ) ){
+    TIFFClose( in );
+    return 1;
+  }
+
+  set_tiff_tags( out, &level->format );
+  TIFFSetField( out, TIFFTAG_SUBFILETYPE, FILETYPE_REDUCEDIMAGE );
+  if( TIFFGetField( in, TIFFTAG_JPEGTABLES, &count, &tables ) ){
+    TIFFSetField( out, TIFFTAG_JPEGTABLES, count, tables );
+  }
+
+  TIFFGetField( in, TIFFTAG_TILEBYTECOUNTS, &sizes );
+  tiles = TIFFNumberOfTiles( in );
+
+  for( t=0; t<tiles && !status; t++ ){
+    unsigned char *tile = malloc( sizes[t] );
+    if( TIFFReadRawTile( in, t, tile, sizes[t] ) != (tmsize_t) sizes[t] ||
+	TIFFWriteRawTile( out, t, tile, sizes[t] ) == -1 ) status = 1;
+    free( tile );
+  }
+
+  TIFFClose( in );
+
+  return status;
+}
+
+
+
+/* Flush any remaining rows, append any pyramid levels, close our image and free
+   our writer
+ */
+int close_output( output_writer *w )
+{
+  output_writer *level, *next;
+  int status = 0;
+
+  if( !w ) return 0;
+
+  if( w->format.type != OUTPUT_TIFF ){
+    status = close_stream_output( w );
+    free( w );
+    return status;
+  }
+
+  if( w->direct ){
+    status = ( close( w->fd ) != 0 );
+    free( w );
+    return status;
+  }
+
+  status = finish_output( w );
+
+  for( level = w->next; level; level = next ){
+    next = level->next;
+    TIFFClose( level->tiff );
+    if( !status ) status = append_pyramid_level( w->tiff, level );
+    unlink( level->filename );
+    free( level->filename );
+    free( level->block );
+    free( level->chunk );
+    free( level->chunk_size );
+    free( level->pending );
+    free( level->reduced );
+    free( level );
+  }
+
+  TIFFClose( w->tiff );
+
+  free( w->block );
+  free( w->chunk );
+  free( w->chunk_size );
+  free( w->pending );
+  free( w->reduced );
+  free( w );
+
+  return status;
+}
@@ -0,0 +1,131 @@
+/*
+    Output image structure
+
+    Copyright (c) 2015-2024, Ruven <ruven@users.sourceforge.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+
+*/
+
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+
+#include <stddef.h>
+#include "tiffio.h"
+
+
+/* Output file types
+ */
+#define OUTPUT_TIFF 0
+#define OUTPUT_RAW 1                /* Interleaved samples with no header */
+#define OUTPUT_PPM 2
+#define OUTPUT_PGM 3
+#define OUTPUT_PFM 4
+#define OUTPUT_NPY 5
+
+
+/* CIE XYZ output, which has no TIFF photometric interpretation and so is only
+   available for raw, PFM and NumPy output
+ */
+#define COLORSPACE_XYZ 0xFFFF
+
+
+/* Output image format
+ */
+typedef struct {
+  unsigned int width;          /* Scanline width and height before any rotation */
+  unsigned int height;
+  unsigned int samples;       /* Samples per pixel: 3 for color, 4 with alpha or any number for data maps */
+  int alpha;                  /* Color followed by an alpha channel flagging invalid pixels */
+  int bits_per_sample;        /* 8 or 16 bit unsigned integer or 32 bit floating point */
+  int half_float;             /* 16 bit samples are IEEE half precision floating point */
+  int type;                   /* Output file type or -1 to choose from the file name */
+  uint16_t colorspace;        /* PHOTOMETRIC_RGB, PHOTOMETRIC_CIELAB, COLORSPACE_XYZ or
+				 PHOTOMETRIC_MINISBLACK for data maps */
+  unsigned int icc_profile;   /* 0: None, 1: sRGB, 2: AdobeRGB */
+  const char *illuminant;     /* Illuminant name, temperature in Kelvin or power spectrum file */
+  double white[3];            /* CIE XYZ white point of our illuminant */
+  double adaptation[3][3];    /* Chromatic adaptation from our white point to D65 */
+  uint16_t compression;
+  double x_resolution;        /* Pixels per cm */
+  double y_resolution;
+  unsigned int tile_size;     /* Tile width and height or 0 for a stripped image */
+  unsigned int rows_per_strip; /* Rows per strip or 0 for the libtiff default */
+  uint16_t predictor;         /* PREDICTOR_NONE, PREDICTOR_HORIZONTAL or PREDICTOR_FLOATINGPOINT */
+  int deflate_level;          /* zlib compression level from 1 to 9 or -1 for the default */
+  int jpeg_quality;           /* JPEG quality from 1 to 100 */
+  int jpeg_subsampling;       /* JPEG chroma subsampling: 2 for 4:2:0 or 1 for 4:4:4 */
+  int bigtiff;                /* 1: BigTIFF, 0: classic TIFF, -1: BigTIFF if required */
+  int pyramid;                /* Add reduced resolution levels down to a single tile */
+  int rotate;                 /* Clockwise rotation of 0, 90, 180 or 270 degrees */
+  int flip;                   /* Mirror scanlines left to right before rotation */
+} output_format;
+
+
+/* Output image writer. Scanlines are written in order and buffered into blocks of
+   rows, from which whole rows of tiles or runs of strips are encoded in parallel.
+   Rotated images are written as tiles out of order: a block of scanlines becomes a
+   row of tiles from the bottom up or, for 90 and 270 degrees, a column of tiles.
+   Pyramid levels are chained writers, each fed by halving the level above
+ */
+typedef struct output_writer {
+  output_format format;
+  TIFF *tiff;
+  size_t line_size;           /* Bytes per output scanline */
+  unsigned int row;           /* Number of scanlines written so far */
+  unsigned char *block;       /* Buffered scanlines for the current block */
+  unsigned int block_rows;    /* Rows per block or 0 to write scanlines directly */
+  unsigned int buffered;      /* Rows currently buffered */
+  unsigned int chunk_rows;    /* Rows per tile or strip */
+  unsigned int chunks;        /* Tiles across the image or 1 for strips */
+  unsigned char **chunk;      /* Encoded data for each tile or strip */
+  size_t *chunk_size;
+  struct output_writer *next; /* Next, half size, pyramid level or NULL */
+  unsigned int level;         /* Pyramid level, where 0 is full resolution */
+  char *filename;             /* Temporary file for reduced pyramid levels */
+  unsigned char *pending;     /* Previous scanline awaiting its pair */
+  unsigned char *reduced;     /* Halved scanline for the next level */
+  int direct;                 /* Uncompressed rows written directly at fixed offsets */
+  int fd;
+  uint64_t data_offset;       /* File offset of our first row for direct output */
+  unsigned int channels;      /* Samples per pixel written by non-TIFF writers */
+  unsigned char *header;      /* File header not yet written */
+  size_t header_size;
+  unsigned char *stream;      /* Gathered scanlines for non-TIFF writers */
+  size_t used;
+} output_writer;
+
+
+TIFF* open_tiff_output( const char*, output_format* );
+size_t output_pixel_size( output_format* );
+int use_bigtiff( output_format* );
+void encode_colors( output_format*, float*, const float*, void*, unsigned int );
+output_writer* open_output( const char*, output_format* );
+int write_output_line( output_writer*, void* );
+int write_output_row( output_writer*, void*, unsigned int );
+
+/* Raw, PNM, PFM and NumPy writers in stream.c
+ */
+int parse_output_type( const char* );
+int output_type_from_filename( const char* );
+int open_stream_output( output_writer*, const char*, output_format* );
+int write_stream_line( output_writer*, void* );
+int close_stream_output( output_writer* );
+int close_output( output_writer* );
+
+
+#endif
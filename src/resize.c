@@ -0,0 +1,238 @@
+/*
+    Streaming image resampling
+
+    Copyright (c) 2015-2024, Ruven <ruven@users.sourceforge.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+
+*/
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "resize.h"
+
+
+
+/* Evaluate our filter kernel at distance x from the sample center
+ */
+static double kernel( int filter, double x )
+{
+  x = fabs( x );
+
+  if( filter == RESIZE_BOX ) return ( x <= 0.5 ) ? 1.0 : 0.0;
+
+  /* Keys cubic convolution with a = -0.5
+   */
+  if( filter == RESIZE_BICUBIC ){
+    if( x < 1.0 ) return ( 1.5*x - 2.5 ) * x*x + 1.0;
+    if( x < 2.0 ) return ( ( -0.5*x + 2.5 ) * x - 4.0 ) * x + 2.0;
+    return 0.0;
+  }
+
+  /* Lanczos with 3 lobes
+   */
+  if( x == 0.0 ) return 1.0;
+  if( x >= 3.0 ) return 0.0;
+  return 3.0 * sin( M_PI*x ) * sin( M_PI*x/3.0 ) / ( M_PI*M_PI*x*x );
+}
+
+
+
+/* Calculate the filter weights for resampling one axis. When reducing, the kernel
+   is stretched to cover all the input pixels that fall within each output pixel
+ */
+static void init_axis( resize_axis *axis, unsigned int in, unsigned int out, int filter )
+{
+  double radius = ( filter == RESIZE_BOX ) ? 0.5 : ( filter == RESIZE_BICUBIC ) ? 2.0 : 3.0;
+  double scale = (double) in / out;
+  double stretch = ( scale > 1.0 ) ? scale : 1.0;
+  double support = radius * stretch;
+  unsigned int i, k;
+
+  axis->taps = (unsigned int) ceil( support ) * 2 + 1;
+  axis->start = malloc( out * sizeof(unsigned int) );
+  axis->count = malloc( out * sizeof(unsigned int) );
+  axis->weights = calloc( (size_t) out * axis->taps, sizeof(float) );
+
+  for( i=0; i<out; i++ ){
+
+    double center = ( i + 0.5 ) * scale;
+    double total = 0.0;
+    int first = (int) floor( center - support + 0.5 );
+    int last = (int) floor( center + support + 0.5 );
+    float *weights = &axis->weights[(size_t)i*axis->taps];
+
+    /* Clip our kernel to the image and renormalize
+     */
+    if( first < 0 ) first = 0;
+    if( last > (int) in ) last = in;
+    if( last - first > (int) axis->taps ) last = first + axis->taps;
+    if( last <= first ){
+      first = ( center < in ) ? (int) center : in - 1;
+      last = first + 1;
+    }
+
+    for( k=0; k<(unsigned int)(last-first); k++ ){
+      weights[k] = kernel( filter, ( first + k + 0.5 - center ) / stretch );
+      total += weights[k];
+    }
+
+    /* Fall back to the nearest pixel if the kernel misses every sample
+     */
+    if( total == 0.0 ){
+      first = ( center < in ) ? (int) center : in - 1;
+      last = first + 1;
+      weights[0] = 1.0;
+      total = 1.0;
+    }
+
+    for( k=0; k<(unsigned int)(last-first); k++ ) weights[k] /= total;
+
+    axis->start[i] = first;
+    axis->count[i] = last - first;
+  }
+}
+
+
+
+/* Parse a resize request either as WxH pixels, where a 0 for either keeps the aspect
+   ratio, or as a single scale factor or a pair of factors (eg: 0.5 or 1x1.25). Returns
+   0 on success
+ */
+int parse_resize( const char *arg, unsigned int in_width, unsigned int in_height,
+		  unsigned int *width, unsigned int *height )
+{
+  double sx, sy;
+  int n;
+
+  if( strchr( arg, '.' ) || !strchr( arg, 'x' ) ){
+    n = sscanf( arg, "%lfx%lf", &sx, &sy );
+    if( n < 1 || sx <= 0.0 ) return 1;
+    if( n == 1 ) sy = sx;
+    if( sy <= 0.0 ) return 1;
+    *width = (unsigned int) floor( in_width * sx + 0.5 );
+    *height = (unsigned int) floor( in_height * sy + 0.5 );
+  }
+  else{
+    if( sscanf( arg, "%ux%u", width, height ) != 2 ) return 1;
+    if( *width == 0 && *height == 0 ) return 1;
+    if( *width == 0 ) *width = (unsigned int) floor( (double) in_width * *height / in_height + 0.5 );
+    if( *height == 0 ) *height = (unsigned int) floor( (double) in_height * *width / in_width + 0.5 );
+  }
+
+  if( *width == 0 ) *width = 1;
+  if( *height == 0 ) *height = 1;
+
+  return 0;
+}
+
+
+
+/* Create a resampler from one image size to another for pixels of the given number
+   of channels
+ */
+resizer* create_resizer( unsigned int in_width, unsigned int in_height,
+			 unsigned int out_width, unsigned int out_height, int filter, unsigned int channels )
+{
+  resizer *r = calloc( 1, sizeof(resizer) );
+
+  r->in_width = in_width;
+  r->in_height = in_height;
+  r->out_width = out_width;
+  r->out_height = out_height;
+  r->channels = channels;
+
+  init_axis( &r->x, in_width, out_width, filter );
+  init_axis( &r->y, in_height, out_height, filter );
+
+  r->window = malloc( (size_t) r->y.taps * out_width * channels * sizeof(float) );
+
+  return r;
+}
+
+
+
+/* Add the next input line, resizing it horizontally into our ring buffer
+ */
+void resize_push( resizer *r, float *line )
+{
+  unsigned int channels = r->channels;
+  float *row = &r->window[(size_t)( r->in_row % r->y.taps ) * r->out_width * channels];
+  int i;
+
+#pragma omp parallel for
+  for( i=0; i<(int)r->out_width; i++ ){
+    float *weights = &r->x.weights[(size_t)i*r->x.taps];
+    float *in = &line[(size_t)r->x.start[i]*channels];
+    float *out = &row[(size_t)i*channels];
+    unsigned int k, c;
+    for( c=0; c<channels; c++ ) out[c] = 0.0f;
+    for( k=0; k<r->x.count[i]; k++ ){
+      for( c=0; c<channels; c++ ) out[c] += weights[k] * in[k*channels + c];
+    }
+  }
+
+  r->in_row++;
+}
+
+
+
+/* Produce the next output line if all the input lines it needs have arrived. Returns
+   1 if a line was written to out and 0 otherwise
+ */
+int resize_pull( resizer *r, float *out )
+{
+  size_t samples = (size_t) r->out_width * r->channels;
+  unsigned int j = r->out_row;
+  unsigned int k;
+
+  if( j >= r->out_height || r->in_row < r->y.start[j] + r->y.count[j] ) return 0;
+
+  float *weights = &r->y.weights[(size_t)j*r->y.taps];
+  memset( out, 0, samples * sizeof(float) );
+
+  /* Accumulate whole rows at a time so that the inner loop vectorizes
+   */
+  for( k=0; k<r->y.count[j]; k++ ){
+    float *row = &r->window[(size_t)( ( r->y.start[j] + k ) % r->y.taps ) * samples];
+    float weight = weights[k];
+    size_t n;
+    for( n=0; n<samples; n++ ) out[n] += weight * row[n];
+  }
+
+  r->out_row++;
+
+  return 1;
+}
+
+
+
+/* Free our resampler
+ */
+void free_resizer( resizer *r )
+{
+  if( !r ) return;
+  free( r->x.start );
+  free( r->x.count );
+  free( r->x.weights );
+  free( r->y.start );
+  free( r->y.count );
+  free( r->y.weights );
+  free( r->window );
+  free( r );
+}
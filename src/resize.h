@@ -0,0 +1,70 @@
+/*
+    Streaming image resampling structure
+
+    Copyright (c) 2015-2024, Ruven <ruven@users.sourceforge.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+
+*/
+
+
+#ifndef RESIZE_H
+#define RESIZE_H
+
+
+/* Resampling filters
+ */
+#define RESIZE_BOX 0
+#define RESIZE_BICUBIC 1
+#define RESIZE_LANCZOS 2
+
+
+/* Filter weights along one axis. Each output pixel is a weighted sum of a run of
+   consecutive input pixels
+ */
+typedef struct {
+  unsigned int taps;          /* Maximum number of input pixels per output pixel */
+  unsigned int *start;        /* First input pixel for each output pixel */
+  unsigned int *count;        /* Number of input pixels for each output pixel */
+  float *weights;             /* Normalized weights, taps per output pixel */
+} resize_axis;
+
+
+/* Streaming resampler for lines of float pixels, such as 3 channel XYZ. Input lines are resized
+   horizontally as they arrive and kept in a ring buffer just tall enough for the
+   vertical filter
+ */
+typedef struct {
+  unsigned int in_width;
+  unsigned int in_height;
+  unsigned int out_width;
+  unsigned int out_height;
+  unsigned int channels;      /* Floats per pixel */
+  resize_axis x;
+  resize_axis y;
+  float *window;              /* Ring buffer of horizontally resized lines */
+  unsigned int in_row;        /* Number of input lines received */
+  unsigned int out_row;       /* Number of output lines produced */
+} resizer;
+
+
+int parse_resize( const char*, unsigned int, unsigned int, unsigned int*, unsigned int* );
+resizer* create_resizer( unsigned int, unsigned int, unsigned int, unsigned int, int, unsigned int );
+void resize_push( resizer*, float* );
+int resize_pull( resizer*, float* );
+void free_resizer( resizer* );
+
+
+#endif
@@ -0,0 +1,380 @@
+/*
+    Spectral TIFF input routines
+
+    Copyright (c) 2015-2024, Ruven <ruven@users.sourceforge.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+
+*/
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "spectral_tiff.h"
+
+
+
+/* Check for a classic or BigTIFF signature
+ */
+int is_tiff( FILE* s )
+{
+  unsigned char magic[4];
+
+  rewind( s );
+  if( fread( magic, 1, 4, s ) != 4 ) return 0;
+  rewind( s );
+
+  if( memcmp( magic, "II", 2 ) == 0 && magic[3] == 0 && ( magic[2] == 42 || magic[2] == 43 ) ) return 1;
+  if( memcmp( magic, "MM", 2 ) == 0 && magic[2] == 0 && ( magic[3] == 42 || magic[3] == 43 ) ) return 1;
+
+  return 0;
+}
+
+
+
+/* Parse a tag holding a single wavelength for a band page
+ */
+static int tag_wavelength( TIFF *tiff, ttag_t tag, double *wavelength )
+{
+  char *text = NULL;
+  char *end;
+
+  if( !TIFFGetField( tiff, tag, &text ) || !text ) return 0;
+
+  *wavelength = strtod( text, &end );
+  if( end == text || *wavelength <= 0.0 ) return 0;
+
+  /* Allow for a unit suffix such as "nm"
+   */
+  while( *end == ' ' ) end++;
+  if( *end != '\0' && strncasecmp( end, "nm", 2 ) != 0 ) return 0;
+
+  return 1;
+}
+
+
+
+/* Find our wavelengths. For multi-page files, each page can carry its wavelength in its
+   PageName or ImageDescription tag. Otherwise look for an ENVI style wavelength list in
+   the ImageDescription of the first page or in an ENVI .hdr sidecar file
+ */
+static int load_wavelengths( const char *filename, spectral_tiff *st, hyspex_header *header )
+{
+  unsigned int n;
+  char *text = NULL;
+  double *wavelengths = NULL;
+
+  if( st->layout == SPECTRAL_TIFF_PAGES ){
+    header->wavelengths = malloc( sizeof(double) * header->bands );
+    for( n=0; n<header->bands; n++ ){
+      if( !tag_wavelength( st->tiff[n], TIFFTAG_PAGENAME, &header->wavelengths[n] ) &&
+	  !tag_wavelength( st->tiff[n], TIFFTAG_IMAGEDESCRIPTION, &header->wavelengths[n] ) ) break;
+    }
+    if( n == header->bands ) return 0;
+    free( header->wavelengths );
+    header->wavelengths = NULL;
+  }
+
+  if( TIFFGetField( st->tiff[0], TIFFTAG_IMAGEDESCRIPTION, &text ) && text ){
+    if( parse_envi_wavelengths( text, &wavelengths ) == (int) header->bands ){
+      header->wavelengths = wavelengths;
+      parse_envi_fwhm( text, header );
+      return 0;
+    }
+    free( wavelengths );
+    wavelengths = NULL;
+  }
+
+  /* Try an ENVI sidecar both with the .tif extension replaced and appended
+   */
+  int i;
+  for( i=0; i<2; i++ ){
+
+    if( ! ( text = load_envi_sidecar( filename, i ) ) ) continue;
+
+    int count = parse_envi_wavelengths( text, &wavelengths );
+    if( count == (int) header->bands ) parse_envi_fwhm( text, header );
+    free( text );
+    if( count == (int) header->bands ){
+      header->wavelengths = wavelengths;
+      return 0;
+    }
+    free( wavelengths );
+    wavelengths = NULL;
+  }
+
+  return 1;
+}
+
+
+
+/* Open a spectral TIFF, either with one band per page or with one band per sample, and
+   fill in our header. Samples must be 8 or 16 bit unsigned integers and are delivered
+   as 16 bit BIL scanlines
+ */
+int open_spectral_tiff( const char *filename, hyspex_header *header )
+{
+  spectral_tiff *st = calloc( 1, sizeof(spectral_tiff) );
+  TIFF *tiff;
+  uint32_t width, height;
+  uint16_t spp = 1, bps = 8, format = SAMPLEFORMAT_UINT, planar = PLANARCONFIG_CONTIG;
+  int n;
+
+  /* Multi-sample spectral images rarely declare their extra samples, which makes
+     libtiff warn on every directory read, so silence warnings while opening
+   */
+  TIFFErrorHandler warning_handler = TIFFSetWarningHandler( NULL );
+
+  if( ! ( tiff = TIFFOpen( filename, "r" ) ) ){
+    fprintf( stderr, "Unable to open TIFF input image '%s'\n", filename );
+    TIFFSetWarningHandler( warning_handler );
+    free( st );
+    return 1;
+  }
+
+  TIFFGetField( tiff, TIFFTAG_IMAGEWIDTH, &width );
+  TIFFGetField( tiff, TIFFTAG_IMAGELENGTH, &height );
+  TIFFGetFieldDefaulted( tiff, TIFFTAG_SAMPLESPERPIXEL, &spp );
+  TIFFGetFieldDefaulted( tiff, TIFFTAG_BITSPERSAMPLE, &bps );
+  TIFFGetFieldDefaulted( tiff, TIFFTAG_SAMPLEFORMAT, &format );
+  TIFFGetFieldDefaulted( tiff, TIFFTAG_PLANARCONFIG, &planar );
+
+  if( format != SAMPLEFORMAT_UINT || ( bps != 8 && bps != 16 ) ){
+    fprintf( stderr, "Unsupported TIFF input: samples must be 8 or 16 bit unsigned integers\n" );
+    goto error;
+  }
+
+  st->bits = bps;
+  st->tiled = TIFFIsTiled( tiff );
+  if( st->tiled ){
+    TIFFGetField( tiff, TIFFTAG_TILEWIDTH, &st->tile_width );
+    TIFFGetField( tiff, TIFFTAG_TILELENGTH, &st->tile_length );
+  }
+
+  header->samples = width;
+  header->scanlines = height;
+  header->size = 0;
+  header->bpp = 2;
+
+  if( spp == 1 ){
+
+    /* One band per page: open a handle on each page
+     */
+    st->layout = SPECTRAL_TIFF_PAGES;
+    st->channels = 1;
+    header->bands = TIFFNumberOfDirectories( tiff );
+    st->handles = header->bands;
+    st->tiff = calloc( st->handles, sizeof(TIFF*) );
+    st->tiff[0] = tiff;
+
+    for( n=1; n<st->handles; n++ ){
+      uint32_t w = 0, h = 0;
+      uint16_t s = 1, b = 0;
+      st->tiff[n] = TIFFOpen( filename, "r" );
+      if( !st->tiff[n] || !TIFFSetDirectory( st->tiff[n], n ) ){
+	fprintf( stderr, "Unable to read page %d of TIFF input image\n", n );
+	goto error;
+      }
+      TIFFGetField( st->tiff[n], TIFFTAG_IMAGEWIDTH, &w );
+      TIFFGetField( st->tiff[n], TIFFTAG_IMAGELENGTH, &h );
+      TIFFGetFieldDefaulted( st->tiff[n], TIFFTAG_SAMPLESPERPIXEL, &s );
+      TIFFGetFieldDefaulted( st->tiff[n], TIFFTAG_BITSPERSAMPLE, &b );
+      if( w != width || h != height || s != 1 || b != bps || TIFFIsTiled( st->tiff[n] ) != st->tiled ){
+	fprintf( stderr, "Page %d of TIFF input image does not match the first page\n", n );
+	goto error;
+      }
+    }
+  }
+  else if( planar == PLANARCONFIG_SEPARATE ){
+
+    /* One band per sample plane: open a handle for each plane
+     */
+    st->layout = SPECTRAL_TIFF_PLANES;
+    st->channels = 1;
+    header->bands = spp;
+    st->handles = spp;
+    st->tiff = calloc( st->handles, sizeof(TIFF*) );
+    st->tiff[0] = tiff;
+    for( n=1; n<st->handles; n++ ){
+      if( ! ( st->tiff[n] = TIFFOpen( filename, "r" ) ) ){
+	fprintf( stderr, "Unable to open TIFF input image '%s'\n", filename );
+	goto error;
+      }
+    }
+  }
+  else{
+
+    /* Pixel interleaved bands are decoded together through a single handle
+     */
+    st->layout = SPECTRAL_TIFF_INTERLEAVED;
+    st->channels = spp;
+    header->bands = spp;
+    st->handles = 1;
+    st->tiff = malloc( sizeof(TIFF*) );
+    st->tiff[0] = tiff;
+  }
+
+  /* Allocate our decoding buffers
+   */
+  size_t row_size = (size_t) width * st->channels * (bps/8);
+  st->rows = malloc( sizeof(unsigned char*) * st->handles );
+  st->tiles = calloc( st->handles, sizeof(unsigned char*) );
+  st->cached = malloc( sizeof(long) * st->handles );
+  for( n=0; n<st->handles; n++ ){
+    st->rows[n] = malloc( row_size );
+    st->cached[n] = -1;
+    if( st->tiled ){
+      size_t tiles_across = ( width + st->tile_width - 1 ) / st->tile_width;
+      st->tiles[n] = malloc( tiles_across * TIFFTileSize( st->tiff[n] ) );
+    }
+  }
+
+  TIFFSetWarningHandler( warning_handler );
+
+  header->source = st;
+
+  if( load_wavelengths( filename, st, header ) != 0 ){
+    fprintf( stderr, "No wavelengths found in TIFF input image or .hdr sidecar: use --wavelengths\n" );
+    header->wavelengths = NULL;
+  }
+
+  return 0;
+
+  /* Close whatever handles we have opened so far
+   */
+ error:
+  if( st->tiff ){
+    for( n=0; n<st->handles; n++ ){
+      if( st->tiff[n] ) TIFFClose( st->tiff[n] );
+    }
+    free( st->tiff );
+  }
+  else TIFFClose( tiff );
+  free( st );
+  TIFFSetWarningHandler( warning_handler );
+
+  return 1;
+}
+
+
+
+/* Decode scanline y of handle n into its row buffer. For tiled images we decode and
+   keep a whole row of tiles at a time
+ */
+static int decode_row( spectral_tiff *st, int n, uint32_t width, uint32_t y )
+{
+  uint16_t plane = ( st->layout == SPECTRAL_TIFF_PLANES ) ? n : 0;
+  size_t pixel_size = st->channels * (st->bits/8);
+
+  if( !st->tiled ){
+    return ( TIFFReadScanline( st->tiff[n], st->rows[n], y, plane ) == -1 ) ? 1 : 0;
+  }
+
+  long tile_row = y / st->tile_length;
+  tmsize_t tile_size = TIFFTileSize( st->tiff[n] );
+  uint32_t x, t;
+
+  if( st->cached[n] != tile_row ){
+    for( x=0, t=0; x<width; x+=st->tile_width, t++ ){
+      uint32_t tile = TIFFComputeTile( st->tiff[n], x, y, 0, plane );
+      if( TIFFReadEncodedTile( st->tiff[n], tile, st->tiles[n] + t*tile_size, tile_size ) == -1 ){
+	st->cached[n] = -1;
+	return 1;
+      }
+    }
+    st->cached[n] = tile_row;
+  }
+
+  /* Copy our row out of each tile
+   */
+  uint32_t r = y % st->tile_length;
+  for( x=0, t=0; x<width; x+=st->tile_width, t++ ){
+    uint32_t w = ( x + st->tile_width > width ) ? width - x : st->tile_width;
+    memcpy( st->rows[n] + x*pixel_size,
+	    st->tiles[n] + t*tile_size + (size_t)r*st->tile_width*pixel_size,
+	    w*pixel_size );
+  }
+
+  return 0;
+}
+
+
+
+/* Load scanline y in 16 bit BIL format. Bands are decoded in parallel. Returns the
+   number of pixels loaded
+ */
+size_t load_spectral_tiff_bil( hyspex_header *header, void *buffer, unsigned int y )
+{
+  spectral_tiff *st = (spectral_tiff*) header->source;
+  unsigned short *bil = (unsigned short*) buffer;
+  int n, errors = 0;
+
+#pragma omp parallel for reduction(+:errors)
+  for( n=0; n<st->handles; n++ ){
+    errors += decode_row( st, n, header->samples, y );
+  }
+
+  if( errors ) return 0;
+
+  /* Rearrange our decoded rows into band interleaved by line order
+   */
+#pragma omp parallel for
+  for( n=0; n<(int)header->bands; n++ ){
+
+    unsigned short *out = bil + (size_t)n * header->samples;
+    unsigned int i;
+
+    /* Decoded row and distance between successive samples of this band
+     */
+    unsigned char *row = ( st->layout == SPECTRAL_TIFF_INTERLEAVED ) ? st->rows[0] : st->rows[n];
+    unsigned int offset = ( st->layout == SPECTRAL_TIFF_INTERLEAVED ) ? n : 0;
+    unsigned int stride = st->channels;
+
+    if( st->bits == 16 ){
+      unsigned short *in = (unsigned short*) row;
+      for( i=0; i<header->samples; i++ ) out[i] = in[i*stride + offset];
+    }
+    else{
+      for( i=0; i<header->samples; i++ ) out[i] = row[i*stride + offset] * 257;
+    }
+  }
+
+  return (size_t) header->samples * header->bands;
+}
+
+
+
+/* Close our handles and free our buffers
+ */
+void close_spectral_tiff( hyspex_header *header )
+{
+  spectral_tiff *st = (spectral_tiff*) header->source;
+  int n;
+
+  if( !st ) return;
+
+  for( n=0; n<st->handles; n++ ){
+    if( st->tiff[n] ) TIFFClose( st->tiff[n] );
+    free( st->rows[n] );
+    free( st->tiles[n] );
+  }
+  free( st->tiff );
+  free( st->rows );
+  free( st->tiles );
+  free( st->cached );
+  free( st );
+  header->source = NULL;
+}
@@ -0,0 +1,63 @@
+/*
+    Spectral TIFF input structure
+
+    Copyright (c) 2015-2024, Ruven <ruven@users.sourceforge.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+
+*/
+
+
+#ifndef SPECTRAL_TIFF_H
+#define SPECTRAL_TIFF_H
+
+
+#include <stdio.h>
+#include "tiffio.h"
+#include "hyspex.h"
+
+
+/* Band layouts of spectral TIFF files
+ */
+#define SPECTRAL_TIFF_PAGES 0         /* One band per page */
+#define SPECTRAL_TIFF_PLANES 1        /* One band per sample with separate planes */
+#define SPECTRAL_TIFF_INTERLEAVED 2   /* One band per sample with interleaved pixels */
+
+
+/* Spectral TIFF input structure. We keep a separate TIFF handle for each band page
+   or plane so that bands can be decoded in parallel
+ */
+typedef struct {
+  int layout;
+  int handles;                 /* Number of TIFF handles */
+  TIFF **tiff;
+  unsigned int channels;       /* Samples per pixel within each decoded row */
+  int bits;                    /* 8 or 16 bits per sample */
+  int tiled;
+  uint32_t tile_width;
+  uint32_t tile_length;
+  unsigned char **rows;        /* Decoded row for each handle */
+  unsigned char **tiles;       /* Decoded row of tiles for each handle */
+  long *cached;                /* Row of tiles held for each handle or -1 */
+} spectral_tiff;
+
+
+int is_tiff( FILE* );
+int open_spectral_tiff( const char*, hyspex_header* );
+size_t load_spectral_tiff_bil( hyspex_header*, void*, unsigned int );
+void close_spectral_tiff( hyspex_header* );
+
+
+#endif
@@ -0,0 +1,280 @@
+/*
+    Raw, PNM, PFM and NumPy output writers
+
+    Copyright (c) 2015-2024, Ruven <ruven@users.sourceforge.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+
+*/
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include "output.h"
+
+
+/* Size of the buffer of scanlines gathered before each write
+ */
+#define STREAM_BUFFER_SIZE ( 4 << 20 )
+
+
+
+/* Output file type from a name given with --format
+ */
+int parse_output_type( const char *name )
+{
+  if( strcasecmp( name, "raw" ) == 0 ) return OUTPUT_RAW;
+  if( strcasecmp( name, "ppm" ) == 0 ) return OUTPUT_PPM;
+  if( strcasecmp( name, "pgm" ) == 0 ) return OUTPUT_PGM;
+  if( strcasecmp( name, "pfm" ) == 0 ) return OUTPUT_PFM;
+  if( strcasecmp( name, "npy" ) == 0 ) return OUTPUT_NPY;
+  if( strcasecmp( name, "tiff" ) == 0 || strcasecmp( name, "tif" ) == 0 ) return OUTPUT_TIFF;
+  return -1;
+}
+
+
+
+/* Output file type from a file name extension. Standard output defaults to raw
+ */
+int output_type_from_filename( const char *filename )
+{
+  const char *extension = strrchr( filename, '.' );
+  int type;
+
+  if( strcmp( filename, "-" ) == 0 ) return OUTPUT_RAW;
+  if( !extension ) return OUTPUT_TIFF;
+  if( strcasecmp( extension, ".bin" ) == 0 ) return OUTPUT_RAW;
+  type = parse_output_type( extension + 1 );
+  return ( type < 0 ) ? OUTPUT_TIFF : type;
+}
+
+
+
+/* Write a set of buffers in full, continuing after partial writes
+ */
+static int write_all( int fd, struct iovec *iov, int count )
+{
+  while( count > 0 ){
+    ssize_t n = writev( fd, iov, count );
+    if( n < 0 ) return 1;
+    while( count > 0 && (size_t) n >= iov->iov_len ){
+      n -= iov->iov_len;
+      iov++;
+      count--;
+    }
+    if( count > 0 ){
+      iov->iov_base = (unsigned char*) iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+  return 0;
+}
+
+
+
+/* Write out our gathered scanlines, preceded by our file header if it has not yet
+   been written, in a single call
+ */
+static int flush_stream( output_writer *w )
+{
+  struct iovec iov[2];
+  int count = 0;
+
+  if( w->header_size > 0 ){
+    iov[count].iov_base = w->header;
+    iov[count++].iov_len = w->header_size;
+  }
+  if( w->used > 0 ){
+    iov[count].iov_base = w->stream;
+    iov[count++].iov_len = w->used;
+  }
+
+  w->header_size = 0;
+  w->used = 0;
+
+  return write_all( w->fd, iov, count );
+}
+
+
+
+/* Open a raw, PPM, PGM, PFM or NumPy output. A file name of "-" writes to standard
+   output. The bit depth is adjusted to one the file type can hold
+ */
+int open_stream_output( output_writer *w, const char *filename, output_format *format )
+{
+  unsigned int one = 1;
+  int little_endian = *(unsigned char*) &one;
+  unsigned int bytes;
+
+  if( format->type == OUTPUT_PPM || format->type == OUTPUT_PGM ){
+    if( format->bits_per_sample == 32 ) format->bits_per_sample = 16;
+    format->half_float = 0;
+  }
+  else if( format->type == OUTPUT_PFM ){
+    format->bits_per_sample = 32;
+    format->half_float = 0;
+  }
+
+  /* Data maps with other than 3 samples per pixel have no PNM equivalent and PFM
+     only has grey and color variants
+   */
+  if( format->samples != 3 &&
+      ( format->type == OUTPUT_PPM || format->type == OUTPUT_PGM || ( format->type == OUTPUT_PFM && format->samples != 1 ) ) ){
+    fprintf( stderr, "Output with %u samples per pixel is not available for PPM, PGM or PFM files\n", format->samples );
+    return 1;
+  }
+
+  bytes = format->bits_per_sample / 8;
+  w->format = *format;
+  w->channels = ( format->type == OUTPUT_PGM ) ? 1 : format->samples;
+  w->line_size = (size_t) format->width * w->channels * bytes;
+
+  /* Build our file header
+   */
+  w->header = malloc( 256 );
+  if( format->type == OUTPUT_PPM || format->type == OUTPUT_PGM ){
+    w->header_size = sprintf( (char*) w->header, "%s\n%u %u\n%u\n", ( w->channels == 1 ) ? "P5" : "P6",
+			      format->width, format->height, ( bytes == 1 ) ? 255 : 65535 );
+  }
+  else if( format->type == OUTPUT_PFM ){
+    w->header_size = sprintf( (char*) w->header, "%s\n%u %u\n%s\n", ( w->channels == 1 ) ? "Pf" : "PF",
+			      format->width, format->height, little_endian ? "-1.0" : "1.0" );
+  }
+  else if( format->type == OUTPUT_NPY ){
+    /* NumPy version 1.0 header, padded with spaces so that our data is 64 byte aligned
+     */
+    const char *descr = ( bytes == 1 ) ? "|u1" :
+      ( bytes == 2 ) ? ( format->half_float ? ( little_endian ? "<f2" : ">f2" ) : ( little_endian ? "<u2" : ">u2" ) ) :
+      ( little_endian ? "<f4" : ">f4" );
+    char shape[64];
+    if( w->channels == 1 ) sprintf( shape, "(%u, %u)", format->height, format->width );
+    else sprintf( shape, "(%u, %u, %u)", format->height, format->width, w->channels );
+    int length = sprintf( (char*) w->header + 10, "{'descr': '%s', 'fortran_order': False, 'shape': %s, }",
+			  descr, shape );
+    uint16_t header_length;
+    while( ( 10 + length + 1 ) % 64 ) w->header[10 + length++] = ' ';
+    w->header[10 + length++] = '\n';
+    header_length = length;
+    memcpy( w->header, "\x93NUMPY\x01\x00", 8 );
+    w->header[8] = header_length & 0xff;
+    w->header[9] = header_length >> 8;
+    w->header_size = 10 + length;
+  }
+
+  if( strcmp( filename, "-" ) == 0 ) w->fd = STDOUT_FILENO;
+  else if( ( w->fd = open( filename, O_WRONLY | O_CREAT | O_TRUNC, 0644 ) ) == -1 ){
+    free( w->header );
+    return 1;
+  }
+
+  /* PFM stores its rows from the bottom up. Write each row in place if we can seek,
+     otherwise hold the whole image until we close
+   */
+  if( format->type == OUTPUT_PFM ){
+    if( lseek( w->fd, 0, SEEK_CUR ) != -1 ){
+      w->data_offset = w->header_size;
+      w->direct = 1;
+      if( flush_stream( w ) != 0 ) return 1;
+    }
+    else w->stream = malloc( w->line_size * format->height );
+    return 0;
+  }
+
+  w->block_rows = STREAM_BUFFER_SIZE / w->line_size;
+  if( w->block_rows == 0 ) w->block_rows = 1;
+  w->stream = malloc( w->block_rows * w->line_size );
+
+  return 0;
+}
+
+
+
+/* Add a scanline to our output, converting to grey or to big endian for PNM files
+ */
+int write_stream_line( output_writer *w, void *line )
+{
+  output_format *format = &w->format;
+  unsigned int bytes = format->bits_per_sample / 8;
+  unsigned char *out;
+  unsigned int i;
+
+  if( format->type == OUTPUT_PFM ){
+    if( w->direct ) return write_output_row( w, line, w->row++ );
+    memcpy( w->stream + (size_t)( format->height - 1 - w->row++ ) * w->line_size, line, w->line_size );
+    return 0;
+  }
+
+  out = w->stream + w->used;
+
+  if( format->type == OUTPUT_PGM ){
+    /* Lightness from L* for CIELAB, Y for XYZ and Rec. 709 luma otherwise
+     */
+    for( i=0; i<format->width; i++ ){
+      float v[3];
+      unsigned int c;
+      for( c=0; c<3; c++ ){
+	v[c] = ( bytes == 1 ) ? ((uint8_t*)line)[i*3 + c] : ((uint16_t*)line)[i*3 + c];
+      }
+      float grey = ( format->colorspace == PHOTOMETRIC_CIELAB ) ? v[0] :
+	( format->colorspace == COLORSPACE_XYZ ) ? v[1] : 0.2126f*v[0] + 0.7152f*v[1] + 0.0722f*v[2];
+      if( bytes == 1 ) out[i] = (uint8_t)( grey + 0.5f );
+      else ((uint16_t*)out)[i] = (uint16_t)( grey + 0.5f );
+    }
+  }
+  else memcpy( out, line, w->line_size );
+
+  /* PNM samples wider than a byte are big endian
+   */
+  if( bytes == 2 && ( format->type == OUTPUT_PPM || format->type == OUTPUT_PGM ) ){
+    unsigned int one = 1;
+    if( *(unsigned char*) &one ){
+      uint16_t *p = (uint16_t*) out;
+      for( i=0; i<format->width*w->channels; i++ ) p[i] = (uint16_t)( ( p[i] << 8 ) | ( p[i] >> 8 ) );
+    }
+  }
+
+  w->used += w->line_size;
+  w->row++;
+
+  if( w->used >= w->block_rows * w->line_size || w->row == format->height ) return flush_stream( w );
+
+  return 0;
+}
+
+
+
+/* Write out anything left and close our output
+ */
+int close_stream_output( output_writer *w )
+{
+  int status = 0;
+
+  if( w->format.type == OUTPUT_PFM && !w->direct ){
+    w->used = w->line_size * w->format.height;
+  }
+  if( w->header_size > 0 || w->used > 0 ) status = flush_stream( w );
+
+  if( w->fd != STDOUT_FILENO && close( w->fd ) != 0 ) status = 1;
+
+  free( w->header );
+  free( w->stream );
+
+  return status;
+}
@@ -0,0 +1,848 @@
+/*
+    Spectral rendering weights
+
+    Copyright (c) 2015-2024, Ruven <ruven@users.sourceforge.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+
+*/
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "weights.h"
+
+
+/* Step in nm over which band responses are integrated
+ */
+#define RESPONSE_STEP 0.1
+
+
+/* Savitzky-Golay coefficients for one band: a least squares polynomial fit over a
+   window of bands, evaluated at the band itself. Windows are kept within the cube,
+   so that the edge bands are fitted from an asymmetric window. Positions are taken
+   from the actual wavelengths, which need not be evenly spaced
+ */
+static void savitzky_golay( const double *wavelengths, unsigned int bands, unsigned int band,
+			    unsigned int window, unsigned int order, double *row )
+{
+  double gram[order+1][order+2];
+  double z[window], scale;
+  unsigned int start, m, j, k;
+
+  start = ( band < window/2 ) ? 0 : band - window/2;
+  if( start + window > bands ) start = bands - window;
+
+  /* Offsets from our band, scaled to the mean band spacing of the window
+   */
+  scale = ( wavelengths[start+window-1] - wavelengths[start] ) / ( window - 1 );
+  for( m=0; m<window; m++ ) z[m] = ( wavelengths[start+m] - wavelengths[band] ) / scale;
+
+  /* Solve the normal equations for the constant term of the polynomial, which is
+     its value at our band
+   */
+  for( j=0; j<=order; j++ ){
+    for( k=0; k<=order; k++ ){
+      gram[j][k] = 0.0;
+      for( m=0; m<window; m++ ) gram[j][k] += pow( z[m], j + k );
+    }
+    gram[j][order+1] = ( j == 0 ) ? 1.0 : 0.0;
+  }
+
+  for( j=0; j<=order; j++ ){
+    unsigned int pivot = j;
+    for( k=j+1; k<=order; k++ ) if( fabs( gram[k][j] ) > fabs( gram[pivot][j] ) ) pivot = k;
+    for( k=0; k<=order+1; k++ ){
+      double t = gram[j][k]; gram[j][k] = gram[pivot][k]; gram[pivot][k] = t;
+    }
+    for( k=0; k<=order; k++ ){
+      if( k == j ) continue;
+      double f = gram[k][j] / gram[j][j];
+      for( m=j; m<=order+1; m++ ) gram[k][m] -= f * gram[j][m];
+    }
+  }
+
+  for( m=0; m<bands; m++ ) row[m] = 0.0;
+  for( m=0; m<window; m++ ){
+    double power = 1.0;
+    for( j=0; j<=order; j++ ){
+      row[start+m] += ( gram[j][order+1] / gram[j][j] ) * power;
+      power *= z[m];
+    }
+  }
+}
+
+
+
+/* Gaussian coefficients for one band, truncated at 3 standard deviations and
+   normalized over the bands within the cube
+ */
+static void gaussian( const double *wavelengths, unsigned int bands, unsigned int band,
+		      double sigma, double *row )
+{
+  double sum = 0.0;
+  unsigned int m;
+
+  for( m=0; m<bands; m++ ){
+    double d = ( wavelengths[m] - wavelengths[band] ) / sigma;
+    row[m] = ( fabs( d ) <= 3.0 ) ? exp( -0.5 * d * d ) : 0.0;
+    sum += row[m];
+  }
+  for( m=0; m<bands; m++ ) row[m] /= sum;
+}
+
+
+
+/* Fold a smoothing filter into our weights. A smoothed spectrum is S x for a bands x
+   bands filter matrix S, so its rendering with weights W is W^T S x and the filter
+   is applied by replacing W with S^T W
+ */
+static void smooth_weights( render_weights *w, double *block, const double *wavelengths,
+			    unsigned int bands, render_options *options )
+{
+  unsigned int window = options->smooth_window;
+  unsigned int order = options->smooth_order;
+  double *filter, *smoothed;
+  unsigned int j, m, c;
+
+  /* Our window must fit within the cube and leave the fit overdetermined
+   */
+  if( window > bands ) window = bands - ( ( bands % 2 ) ? 0 : 1 );
+  if( order >= window ) order = window - 1;
+  if( options->smooth == SMOOTH_SAVITZKY_GOLAY && window < 3 ) return;
+
+  filter = malloc( sizeof(double) * bands );
+  smoothed = calloc( (size_t) bands * w->stride, sizeof(double) );
+
+  for( j=0; j<bands; j++ ){
+
+    const double *weights = block + (size_t)j * w->stride;
+
+    if( options->smooth == SMOOTH_GAUSSIAN ) gaussian( wavelengths, bands, j, options->smooth_sigma, filter );
+    else savitzky_golay( wavelengths, bands, j, window, order, filter );
+
+    /* Band j of our smoothed spectrum draws filter[m] of each band m
+     */
+    for( m=0; m<bands; m++ ){
+      if( filter[m] == 0.0 ) continue;
+      for( c=0; c<w->stride; c++ ) smoothed[(size_t)m*w->stride + c] += filter[m] * weights[c];
+    }
+  }
+
+  memcpy( block, smoothed, sizeof(double) * bands * w->stride );
+  free( smoothed );
+  free( filter );
+}
+
+
+
+/* Load a table of band responses: a wavelength followed by the response of each band
+   on each line, which may be of any length. Lines without a value for every band, such
+   as headers, are skipped. Returns the number of rows loaded
+ */
+static unsigned int load_responses( const char *filename, unsigned int bands, double **table )
+{
+  FILE *file;
+  char *line = NULL;
+  size_t size = 0;
+  unsigned int rows = 0;
+  double row[bands+1];
+
+  *table = NULL;
+
+  if( ! ( file = fopen( filename, "r" ) ) ){
+    fprintf( stderr, "Unable to open band response file: '%s'\n", filename );
+    return 0;
+  }
+
+  while( getline( &line, &size, file ) != -1 ){
+
+    char *p = line, *end;
+    unsigned int n = 0;
+
+    if( line[0] == '#' ) continue;
+    while( n <= bands ){
+      row[n] = strtod( p, &end );
+      if( end == p ) break;
+      n++;
+      p = end;
+      while( *p == ',' || *p == ';' ) p++;
+    }
+    if( n != bands+1 ) continue;
+    if( rows && row[0] <= (*table)[(rows-1)*(bands+1)] ) continue;
+
+    *table = realloc( *table, sizeof(double) * (bands+1) * (rows+1) );
+    memcpy( *table + (size_t)rows*(bands+1), row, sizeof(double) * (bands+1) );
+    rows++;
+  }
+  free( line );
+  fclose( file );
+
+  if( rows < 2 ) fprintf( stderr, "Band response file needs a wavelength and %u responses per line: '%s'\n", bands, filename );
+
+  return rows;
+}
+
+
+
+/* Account for the spectral response of each band. Our weights reconstruct a spectrum
+   by linear interpolation between the band values. A band with a broad response
+   does not sample that spectrum at its wavelength, but averages it under its
+   response, so measured values are b = G c for interpolated values c, where G holds
+   the integral of each band's response over each interpolating function. Rendering
+   with weights W from c is then W^T G^-1 b, and the responses are applied by
+   replacing W with G^-T W. Narrow responses leave G as the identity. Our bands are
+   those given by index within the full set of bands of the response table and widths
+ */
+static int band_responses( render_weights *w, double *weights, const double *wavelengths,
+			   unsigned int bands, const unsigned int *index, render_options *options,
+			   const double *table, unsigned int rows )
+{
+  unsigned int columns = w->bands + 1;
+  unsigned int stride = w->stride;
+  double first = wavelengths[0], last = wavelengths[bands-1];
+  unsigned int steps = ceil( ( last - first ) / RESPONSE_STEP );
+  unsigned int row = 0;
+  double *gram, *norm;
+  unsigned int s, i = 0, j, k, c;
+
+  gram = calloc( (size_t) bands * bands, sizeof(double) );
+  norm = calloc( bands, sizeof(double) );
+
+  /* Integrate each response over the interpolating functions of the two bands either
+     side of each step. Only the range covered by our bands is integrated, so that
+     constant spectra are preserved
+   */
+  for( s=0; s<=steps; s++ ){
+
+    double wavelength = ( s == steps ) ? last : first + s * RESPONSE_STEP;
+    double t, u = 0.0;
+
+    while( i < bands-2 && wavelengths[i+1] < wavelength ) i++;
+    t = ( wavelength - wavelengths[i] ) / ( wavelengths[i+1] - wavelengths[i] );
+
+    if( table ){
+      if( wavelength < table[0] || wavelength > table[(size_t)(rows-1)*columns] ) continue;
+      while( row < rows-2 && table[(size_t)(row+1)*columns] < wavelength ) row++;
+      u = ( wavelength - table[(size_t)row*columns] ) /
+	( table[(size_t)(row+1)*columns] - table[(size_t)row*columns] );
+    }
+
+    for( k=0; k<bands; k++ ){
+
+      double response;
+
+      if( table ){
+	response = ( 1.0 - u ) * table[(size_t)row*columns + index[k]+1] + u * table[(size_t)(row+1)*columns + index[k]+1];
+      }
+      else{
+	double d = ( wavelength - wavelengths[k] ) * 2.0 * sqrt( 2.0 * log( 2.0 ) ) / options->fwhm[index[k]];
+	response = ( fabs( d ) <= 4.0 ) ? exp( -0.5 * d * d ) : 0.0;
+      }
+      if( response <= 0.0 ) continue;
+
+      gram[(size_t)k*bands + i] += ( 1.0 - t ) * response;
+      gram[(size_t)k*bands + i+1] += t * response;
+      norm[k] += response;
+    }
+  }
+
+  /* Each band averages over its response. Bands with no response within our range
+     are taken as point samples
+   */
+  for( k=0; k<bands; k++ ){
+    if( norm[k] > 0.0 ) for( j=0; j<bands; j++ ) gram[(size_t)k*bands + j] /= norm[k];
+    else gram[(size_t)k*bands + k] = 1.0;
+  }
+  free( norm );
+
+  /* Solve G^T X = W by Gaussian elimination with partial pivoting, working on the
+     transpose in place
+   */
+  for( k=0; k<bands; k++ ){
+    for( j=k+1; j<bands; j++ ){
+      double t = gram[(size_t)j*bands + k]; gram[(size_t)j*bands + k] = gram[(size_t)k*bands + j]; gram[(size_t)k*bands + j] = t;
+    }
+  }
+
+  for( k=0; k<bands; k++ ){
+
+    unsigned int pivot = k;
+    for( j=k+1; j<bands; j++ ){
+      if( fabs( gram[(size_t)j*bands + k] ) > fabs( gram[(size_t)pivot*bands + k] ) ) pivot = j;
+    }
+    if( fabs( gram[(size_t)pivot*bands + k] ) < 1e-9 ){
+      fprintf( stderr, "Band responses are too broad to be resolved\n" );
+      free( gram );
+      return 1;
+    }
+    if( pivot != k ){
+      for( j=0; j<bands; j++ ){
+	double t = gram[(size_t)k*bands + j]; gram[(size_t)k*bands + j] = gram[(size_t)pivot*bands + j]; gram[(size_t)pivot*bands + j] = t;
+      }
+      for( c=0; c<stride; c++ ){
+	double t = weights[(size_t)k*stride + c]; weights[(size_t)k*stride + c] = weights[(size_t)pivot*stride + c]; weights[(size_t)pivot*stride + c] = t;
+      }
+    }
+
+    for( j=k+1; j<bands; j++ ){
+      double f = gram[(size_t)j*bands + k] / gram[(size_t)k*bands + k];
+      if( f == 0.0 ) continue;
+      for( i=k; i<bands; i++ ) gram[(size_t)j*bands + i] -= f * gram[(size_t)k*bands + i];
+      for( c=0; c<stride; c++ ) weights[(size_t)j*stride + c] -= f * weights[(size_t)k*stride + c];
+    }
+  }
+
+  for( k=bands; k-- > 0; ){
+    for( c=0; c<stride; c++ ){
+      double sum = weights[(size_t)k*stride + c];
+      for( j=k+1; j<bands; j++ ) sum -= gram[(size_t)k*bands + j] * weights[(size_t)j*stride + c];
+      weights[(size_t)k*stride + c] = sum / gram[(size_t)k*bands + k];
+    }
+  }
+
+  free( gram );
+
+  return 0;
+}
+
+
+
+/* Columns whose wavelengths all lie within this many nm of those of an existing
+   group of columns share its weights
+ */
+#define SMILE_TOLERANCE 0.05
+
+
+
+/* Load the wavelengths of every band for each column of the sensor, one line of any
+   length per column in order. Lines without a wavelength for every band, such as
+   headers, are skipped. Returns 1 unless every column is given
+ */
+static int load_smile( const char *filename, unsigned int samples, unsigned int bands, double *table )
+{
+  FILE *file;
+  char *line = NULL;
+  size_t size = 0;
+  unsigned int columns = 0;
+
+  if( ! ( file = fopen( filename, "r" ) ) ){
+    fprintf( stderr, "Unable to open smile calibration file: '%s'\n", filename );
+    return 1;
+  }
+
+  while( columns < samples && getline( &line, &size, file ) != -1 ){
+
+    double *row = table + (size_t)columns * bands;
+    char *p = line, *end;
+    unsigned int n = 0;
+
+    if( line[0] == '#' ) continue;
+    while( n < bands ){
+      row[n] = strtod( p, &end );
+      if( end == p ) break;
+      n++;
+      p = end;
+      while( *p == ',' || *p == ';' ) p++;
+    }
+    if( n == bands ) columns++;
+  }
+  free( line );
+  fclose( file );
+
+  if( columns < samples ){
+    fprintf( stderr, "Smile calibration file needs the wavelengths of %u bands for each of %u columns: '%s'\n",
+	     bands, samples, filename );
+    return 1;
+  }
+
+  return 0;
+}
+
+
+
+/* Shift the wavelengths of all bands in each column by a polynomial in the offset of
+   the column from the center of the sensor, scaled to run from -1 to 1
+ */
+static void smile_polynomial( const double *wavelengths, unsigned int samples, unsigned int bands,
+			      const double *coefficients, unsigned int terms, double *table )
+{
+  unsigned int x, k, n;
+
+  for( x=0; x<samples; x++ ){
+    double u = ( samples > 1 ) ? ( 2.0 * x - ( samples - 1 ) ) / ( samples - 1 ) : 0.0;
+    double shift = 0.0;
+    for( n=terms; n-- > 0; ) shift = shift * u + coefficients[n];
+    for( k=0; k<bands; k++ ) table[(size_t)x*bands + k] = wavelengths[k] + shift;
+  }
+}
+
+
+
+/* Group columns whose wavelengths agree to within our tolerance, recording the group
+   of each column and the first column of each group, whose wavelengths are used for
+   the whole group. Returns the number of groups
+ */
+static unsigned int group_columns( const double *table, unsigned int samples, unsigned int bands,
+				   unsigned int *group, unsigned int *first )
+{
+  unsigned int groups = 0, x, n, k;
+
+  for( x=0; x<samples; x++ ){
+
+    const double *wavelengths = table + (size_t)x * bands;
+    group[x] = groups;
+
+    /* Smile varies smoothly across the sensor, so start with the group of the
+       previous column
+     */
+    for( n=0; n<groups && group[x] == groups; n++ ){
+      unsigned int g = ( group[x-1] + n ) % groups;
+      const double *shared = table + (size_t)first[g] * bands;
+      for( k=0; k<bands && fabs( wavelengths[k] - shared[k] ) <= SMILE_TOLERANCE; k++ );
+      if( k == bands ) group[x] = g;
+    }
+
+    if( group[x] == groups ) first[groups++] = x;
+  }
+
+  return groups;
+}
+
+
+
+/* Interpolation weights for one block of bands at the given wavelengths. Each 1nm
+   step of the color matching functions from the first band to 830nm is linearly
+   interpolated between its two neighbouring bands, so its contribution is shared
+   between them. Results are scaled so that a perfect reflector has Y=100
+ */
+static void interpolate_weights( render_weights *w, double *block, const double *wavelengths,
+				 unsigned int bands, const double *power, double match[][3] )
+{
+  unsigned int n, i, c;
+  int first, k;
+
+  first = ceil( wavelengths[0] );
+  if( first < ILLUMINANT_FIRST ) first = ILLUMINANT_FIRST;
+
+  for( n=0; n<w->sets; n++ ){
+
+    const double *p = power + (size_t)n * ILLUMINANT_SIZE;
+    int te = first - ILLUMINANT_FIRST;
+    double norm = 0.0;
+
+    /* Calculate CIE normalization
+     */
+    for( k=0; k<=ILLUMINANT_LAST-first; k++ ){
+      norm += match[te+k][1] * p[te+k];
+    }
+
+    /* Share each step between the bands either side of it. Steps beyond our last
+       band are not covered by the data
+     */
+    i = 0;
+    for( k=0; k<=ILLUMINANT_LAST-first; k++ ){
+
+      double wavelength = first + k;
+      double t;
+
+      if( wavelength > wavelengths[bands-1] ) break;
+      while( i < bands-2 && wavelengths[i+1] < wavelength ) i++;
+
+      t = ( wavelength - wavelengths[i] ) / ( wavelengths[i+1] - wavelengths[i] );
+
+      for( c=0; c<3; c++ ){
+	double weight = match[te+k][c] * p[te+k] * 100.0 / norm;
+	block[(size_t)i*w->stride + 3*n + c] += ( 1.0 - t ) * weight;
+	block[(size_t)(i+1)*w->stride + 3*n + c] += t * weight;
+      }
+    }
+  }
+}
+
+
+
+/* Load a color correction from camera RGB to CIE XYZ from a text file with a row of
+   coefficients for each of X, Y and Z: 3 for a matrix or 6 or 13 for a root-polynomial
+   of second or third degree. Both are scale invariant, so the correction applies
+   equally to our camera RGB scaled so that green is 100 for a perfect white. Returns
+   the number of terms or 0 on error
+ */
+static unsigned int load_correction( const char *filename, double correction[][CORRECTION_TERMS] )
+{
+  FILE *file;
+  char line[1024];
+  unsigned int rows = 0, terms = 0, n;
+  int status = 0;
+
+  if( ! ( file = fopen( filename, "r" ) ) ){
+    fprintf( stderr, "Unable to open color correction file: '%s'\n", filename );
+    return 0;
+  }
+
+  while( status == 0 && fgets( line, sizeof(line), file ) ){
+
+    char *p = line, *end;
+    double value;
+
+    if( line[0] == '#' ) continue;
+
+    n = 0;
+    while( ( value = strtod( p, &end ) ), end != p ){
+      if( rows < 3 && n < CORRECTION_TERMS ) correction[rows][n] = value;
+      n++;
+      p = end + strspn( end, " ,;\t" );
+    }
+    if( n == 0 ) continue;
+
+    if( rows == 3 || ( n != 3 && n != 6 && n != 13 ) || ( rows && n != terms ) ) status = 1;
+    terms = n;
+    rows++;
+  }
+  fclose( file );
+
+  if( status != 0 || rows != 3 ){
+    fprintf( stderr, "Color correction needs 3 rows of 3, 6 or 13 coefficients: '%s'\n", filename );
+    return 0;
+  }
+
+  return terms;
+}
+
+
+
+/* Apply a camera color correction to an RGB triplet. The root-polynomial terms are
+   the square roots of the products of pairs of channels and, for the third degree,
+   the cube roots of the products of three channels. Negative values from noise or
+   dark subtraction are left out of the roots
+ */
+static void correct_color( double correction[][CORRECTION_TERMS], unsigned int terms,
+			   const double *rgb, double *XYZ )
+{
+  double t[CORRECTION_TERMS];
+  double r = ( rgb[0] > 0.0 ) ? rgb[0] : 0.0;
+  double g = ( rgb[1] > 0.0 ) ? rgb[1] : 0.0;
+  double b = ( rgb[2] > 0.0 ) ? rgb[2] : 0.0;
+  unsigned int c, n;
+
+  t[0] = rgb[0];
+  t[1] = rgb[1];
+  t[2] = rgb[2];
+
+  if( terms > 3 ){
+    t[3] = sqrt( r * g );
+    t[4] = sqrt( g * b );
+    t[5] = sqrt( r * b );
+  }
+  if( terms > 6 ){
+    t[6] = cbrt( r * g * g );
+    t[7] = cbrt( g * b * b );
+    t[8] = cbrt( r * b * b );
+    t[9] = cbrt( g * r * r );
+    t[10] = cbrt( b * g * g );
+    t[11] = cbrt( b * r * r );
+    t[12] = cbrt( r * g * b );
+  }
+
+  for( c=0; c<3; c++ ){
+    XYZ[c] = 0.0;
+    for( n=0; n<terms; n++ ) XYZ[c] += correction[c][n] * t[n];
+  }
+}
+
+
+
+/* Fold a matrix color correction into our weights and offsets, which are linear in
+   camera RGB for each illuminant
+ */
+static void correct_weights( render_weights *w, unsigned int samples, double correction[][CORRECTION_TERMS] )
+{
+  size_t rows = (size_t) w->groups * w->bands, r;
+  unsigned int n;
+
+  for( r=0; r<rows; r++ ){
+    for( n=0; n<w->sets; n++ ){
+      double *rgb = w->weights + r * w->stride + 3*n;
+      double XYZ[3];
+      correct_color( correction, 3, rgb, XYZ );
+      memcpy( rgb, XYZ, sizeof(XYZ) );
+    }
+  }
+
+  if( w->offset ){
+    for( r=0; r<samples; r++ ){
+      for( n=0; n<w->sets; n++ ){
+	double *rgb = w->offset + r * w->stride + 3*n;
+	double XYZ[3];
+	correct_color( correction, 3, rgb, XYZ );
+	memcpy( rgb, XYZ, sizeof(XYZ) );
+      }
+    }
+  }
+}
+
+
+
+/* Fold a flat-field correction into our weights. Reflectance is the gain of each
+   band and column, 1 / ( white - dark ), applied to each value after subtracting the
+   dark reference. Each column is given its own block of weights scaled by its
+   gains, and the dark reference becomes a constant offset for the column. Bands
+   with no signal in the white reference are ignored
+ */
+static void flat_field( render_weights *w, unsigned int samples, const double *white, const double *dark )
+{
+  unsigned int bands = w->bands, stride = w->stride;
+  size_t size = (size_t) bands * stride;
+  double *weights = malloc( sizeof(double) * samples * size );
+  unsigned int x, k, c;
+
+  w->offset = calloc( (size_t) samples * stride, sizeof(double) );
+
+  for( x=0; x<samples; x++ ){
+
+    const double *block = w->weights + ( w->group ? w->group[x] : 0 ) * size;
+    double *scaled = weights + (size_t)x * size;
+    double *offset = w->offset + (size_t)x * stride;
+
+    for( k=0; k<bands; k++ ){
+      double black = dark ? dark[(size_t)x*bands + k] : 0.0;
+      double range = white[(size_t)x*bands + k] - black;
+      double gain = ( range > 0.0 ) ? 1.0 / range : 0.0;
+      for( c=0; c<stride; c++ ){
+	scaled[(size_t)k*stride + c] = gain * block[(size_t)k*stride + c];
+	offset[c] -= black * scaled[(size_t)k*stride + c];
+      }
+    }
+  }
+
+  free( w->weights );
+  w->weights = weights;
+  w->groups = samples;
+  if( !w->group ) w->group = malloc( sizeof(unsigned int) * samples );
+  for( x=0; x<samples; x++ ) w->group[x] = x;
+}
+
+
+
+/* Calculate stacked weights for a set of illuminants for the given observer. The
+   white point of each illuminant, and of D65 as a reference for chromatic
+   adaptation, are calculated over the full range of the observer. Columns with
+   spectral smile are grouped by their wavelengths and each group is given its own
+   interpolation weights over the good bands, into which band responses and any
+   smoothing are then folded. A flat-field correction, if any, is folded in next and
+   a matrix correction for a simulated camera last
+ */
+int create_weights( hyspex_header *header, const char **illuminants, unsigned int sets,
+		    render_options *options, render_weights *w )
+{
+  unsigned int bands = header->bands;
+  unsigned int samples = header->samples;
+  double reference[ILLUMINANT_SIZE];
+  double match[ILLUMINANT_SIZE][3], observer[ILLUMINANT_SIZE][3];
+  double correction[3][CORRECTION_TERMS];
+  double *power, *table = NULL, *responses = NULL;
+  double *compact = NULL, *wavelengths = NULL;
+  unsigned int *first = NULL, *index = NULL;
+  unsigned int rows = 0, good = 0, terms = 0, n, g, x, k;
+  int status = 0;
+
+  if( bands < 2 || !header->wavelengths ){
+    fprintf( stderr, "At least two bands with known wavelengths are needed for color rendering\n" );
+    return 1;
+  }
+
+  /* A simulated camera sees through its own sensitivities, but chromatic adaptation
+     is still to D65 for the observer
+   */
+  observer_match( options->observer, observer );
+  if( options->camera_file ){
+    if( camera_match( options->camera_file, match ) != 0 ) return 1;
+  }
+  else memcpy( match, observer, sizeof(match) );
+
+  if( options->correction_file ){
+    if( ( terms = load_correction( options->correction_file, correction ) ) == 0 ) return 1;
+  }
+
+  illuminant_power( "D65", reference );
+
+  w->bands = bands;
+  w->sets = sets;
+  w->stride = 3 * sets;
+  w->observer = options->observer;
+  w->groups = 1;
+  w->group = NULL;
+  w->weights = NULL;
+  w->offset = NULL;
+  w->terms = 0;
+  w->white = malloc( sizeof(double) * w->stride );
+  illuminant_white( reference, observer, w->reference );
+
+  power = malloc( sizeof(double) * ILLUMINANT_SIZE * sets );
+  for( n=0; n<sets; n++ ){
+    if( illuminant_power( illuminants[n], power + (size_t)n * ILLUMINANT_SIZE ) != 0 ){
+      status = 1;
+      goto cleanup;
+    }
+    illuminant_white( power + (size_t)n * ILLUMINANT_SIZE, match, &w->white[3*n] );
+    if( terms ){
+      double rgb[3];
+      memcpy( rgb, &w->white[3*n], sizeof(rgb) );
+      correct_color( correction, terms, rgb, &w->white[3*n] );
+    }
+  }
+
+  /* Wavelengths of each column for sensors with spectral smile
+   */
+  if( options->smile_file || options->smile_terms ){
+    table = malloc( sizeof(double) * samples * bands );
+    if( options->smile_file ){
+      if( load_smile( options->smile_file, samples, bands, table ) != 0 ){
+	status = 1;
+	goto cleanup;
+      }
+    }
+    else smile_polynomial( header->wavelengths, samples, bands, options->smile, options->smile_terms, table );
+
+    for( x=0; x<samples; x++ ){
+      for( k=1; k<bands; k++ ){
+	if( table[(size_t)x*bands + k] <= table[(size_t)x*bands + k-1] ){
+	  fprintf( stderr, "Smile wavelengths must increase from band to band: column %u\n", x );
+	  status = 1;
+	  goto cleanup;
+	}
+      }
+    }
+
+    w->group = malloc( sizeof(unsigned int) * samples );
+    first = malloc( sizeof(unsigned int) * samples );
+    w->groups = group_columns( table, samples, bands, w->group, first );
+  }
+
+  if( options->response == RESPONSE_TABULATED ){
+    if( ( rows = load_responses( options->response_file, bands, &responses ) ) < 2 ){
+      status = 1;
+      goto cleanup;
+    }
+  }
+
+  /* Bad bands are left out altogether: weights are derived from the remaining bands
+     as if the bad ones did not exist and are zero for the bad bands themselves
+   */
+  index = malloc( sizeof(unsigned int) * bands );
+  for( k=0; k<bands; k++ ){
+    if( !options->bad_bands || !options->bad_bands[k] ) index[good++] = k;
+  }
+  if( good < 2 ){
+    fprintf( stderr, "At least two good bands are needed for color rendering\n" );
+    status = 1;
+    goto cleanup;
+  }
+
+  w->weights = calloc( (size_t) w->groups * bands * w->stride, sizeof(double) );
+  compact = malloc( sizeof(double) * good * w->stride );
+  wavelengths = malloc( sizeof(double) * good );
+
+  for( g=0; g<w->groups; g++ ){
+
+    const double *all = table ? table + (size_t)first[g] * bands : header->wavelengths;
+    double *block = w->weights + (size_t)g * bands * w->stride;
+
+    for( k=0; k<good; k++ ) wavelengths[k] = all[index[k]];
+    memset( compact, 0, sizeof(double) * good * w->stride );
+
+    interpolate_weights( w, compact, wavelengths, good, power, match );
+
+    if( options->response != RESPONSE_POINT &&
+	band_responses( w, compact, wavelengths, good, index, options, responses, rows ) != 0 ){
+      status = 1;
+      break;
+    }
+    if( options->smooth != SMOOTH_NONE ) smooth_weights( w, compact, wavelengths, good, options );
+
+    for( k=0; k<good; k++ ){
+      memcpy( block + (size_t)index[k] * w->stride, compact + (size_t)k * w->stride, sizeof(double) * w->stride );
+    }
+  }
+
+  if( status == 0 && options->white_ref ) flat_field( w, samples, options->white_ref, options->dark_ref );
+
+  if( status == 0 && terms == 3 ) correct_weights( w, samples, correction );
+  else if( status == 0 && terms ){
+    w->terms = terms;
+    memcpy( w->correction, correction, sizeof(correction) );
+  }
+
+ cleanup:
+  free( power );
+  free( index );
+  free( compact );
+  free( wavelengths );
+  free( table );
+  free( first );
+  free( responses );
+  if( status != 0 ) free_weights( w );
+
+  return status;
+}
+
+
+
+/* Calculate the CIE XYZ values of a spectrum from the given column of the sensor
+   for each of our stacked illuminants, correcting the RGB of a simulated camera
+ */
+void apply_weights( render_weights *w, unsigned int column, const double *spectrum, float *XYZ )
+{
+  const double *block = w->weights;
+  double sum[w->stride];
+  unsigned int k, c;
+
+  if( w->group ) block += (size_t)w->group[column] * w->bands * w->stride;
+
+  for( c=0; c<w->stride; c++ ) sum[c] = w->offset ? w->offset[(size_t)column*w->stride + c] : 0.0;
+
+  for( k=0; k<w->bands; k++ ){
+    const double *weights = block + (size_t)k * w->stride;
+    double value = spectrum[k];
+    for( c=0; c<w->stride; c++ ) sum[c] += value * weights[c];
+  }
+
+  /* Root-polynomial camera correction of each illuminant
+   */
+  if( w->terms ){
+    for( c=0; c<w->sets; c++ ){
+      double rgb[3] = { sum[3*c], sum[3*c + 1], sum[3*c + 2] };
+      correct_color( w->correction, w->terms, rgb, &sum[3*c] );
+    }
+  }
+
+  for( c=0; c<w->stride; c++ ) XYZ[c] = (float) sum[c];
+}
+
+
+
+void free_weights( render_weights *w )
+{
+  free( w->weights );
+  free( w->white );
+  free( w->group );
+  free( w->offset );
+  w->weights = NULL;
+  w->offset = NULL;
+  w->white = NULL;
+  w->group = NULL;
+}
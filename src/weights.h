@@ -0,0 +1,110 @@
+/*
+    Spectral rendering weights structure
+
+    Copyright (c) 2015-2024, Ruven <ruven@users.sourceforge.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+
+*/
+
+
+#ifndef WEIGHTS_H
+#define WEIGHTS_H
+
+
+#include "hyspex.h"
+#include "illuminant.h"
+
+
+/* Spectral smoothing filters
+ */
+#define SMOOTH_NONE 0
+#define SMOOTH_SAVITZKY_GOLAY 1
+#define SMOOTH_GAUSSIAN 2
+
+
+/* Band spectral response functions: a point sample at each band's wavelength, a
+   Gaussian of each band's full width at half maximum or tabulated responses
+ */
+#define RESPONSE_POINT 0
+#define RESPONSE_GAUSSIAN 1
+#define RESPONSE_TABULATED 2
+
+
+/* Maximum number of terms of a camera color correction: 3 for a matrix, 6 or 13
+   for a root-polynomial of second or third degree
+ */
+#define CORRECTION_TERMS 13
+
+
+/* Settings from which our weights are built
+ */
+typedef struct {
+  int observer;               /* OBSERVER_2 or OBSERVER_10 */
+  int smooth;                 /* SMOOTH_NONE, SMOOTH_SAVITZKY_GOLAY or SMOOTH_GAUSSIAN */
+  unsigned int smooth_window; /* Savitzky-Golay window in bands, which must be odd */
+  unsigned int smooth_order;  /* Savitzky-Golay polynomial order */
+  double smooth_sigma;        /* Gaussian standard deviation in nm */
+  int response;               /* RESPONSE_POINT, RESPONSE_GAUSSIAN or RESPONSE_TABULATED */
+  const double *fwhm;         /* Band widths in nm for Gaussian responses */
+  const char *response_file;  /* Wavelength followed by the response of each band per line */
+  const char *smile_file;     /* Wavelengths of every band for each column, one column per line */
+  const double *smile;        /* Polynomial coefficients of the wavelength shift across columns */
+  unsigned int smile_terms;   /* Number of smile coefficients or 0 */
+  const double *white_ref;    /* Mean white reference of each band for each column or NULL */
+  const double *dark_ref;     /* Mean dark reference of each band for each column or NULL */
+  const unsigned char *bad_bands; /* Flag for each band to be left out or NULL */
+  const char *camera_file;    /* Camera RGB sensitivities replacing the observer or NULL */
+  const char *correction_file; /* Camera RGB to CIE XYZ color correction or NULL */
+} render_options;
+
+
+/* Rendering weights. Interpolating the bands onto the 1nm grid of the color
+   matching functions and integrating under an illuminant is linear in the band
+   values, so CIE XYZ is a product of each spectrum with a bands x 3 matrix. The
+   matrices for several illuminants are stacked side by side so that every
+   rendering is calculated in the same pass. Any linear filter along the bands,
+   such as smoothing, is premultiplied into the weights in the same way. Sensors
+   with spectral smile have different wavelengths in each column, so columns are
+   grouped by their wavelengths and each group has its own block of weights. A
+   flat-field correction scales each band of each column by a gain after
+   subtracting a dark offset, which is also linear, so it gives every column its
+   own block and a constant offset. A camera is simulated by replacing the color
+   matching functions with its RGB sensitivities. A matrix correction from camera
+   RGB to XYZ is folded into the weights, but a root-polynomial correction is not
+   linear and is applied to the result of the weights instead
+ */
+typedef struct {
+  unsigned int bands;
+  unsigned int sets;          /* Number of stacked illuminants */
+  unsigned int stride;        /* Weights per band: X, Y and Z for each set */
+  unsigned int groups;        /* Number of blocks of weights */
+  unsigned int *group;        /* Block used by each column or NULL for a single block */
+  double *weights;            /* Row of stride weights for each band of each block */
+  double *offset;             /* Stride values added for each column or NULL */
+  unsigned int terms;         /* Terms of a root-polynomial correction or 0 for none */
+  double correction[3][CORRECTION_TERMS]; /* Root-polynomial coefficients for X, Y and Z */
+  int observer;               /* OBSERVER_2 or OBSERVER_10 */
+  double *white;              /* XYZ white point of each illuminant */
+  double reference[3];        /* XYZ white point of D65 for the same observer */
+} render_weights;
+
+
+int create_weights( hyspex_header*, const char**, unsigned int, render_options*, render_weights* );
+void apply_weights( render_weights*, unsigned int, const double*, float* );
+void free_weights( render_weights* );
+
+
+#endif
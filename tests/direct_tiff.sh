@@ -0,0 +1,45 @@
+#!/bin/sh
+#
+# Check that uncompressed stripped TIFF output, which is written directly
+# without libtiff, reads back through libtiff with the same tags and pixels as
+# the same rendering written through libtiff with LZW compression. Both
+# classic TIFF and BigTIFF are checked, with and without an alpha channel and
+# with and without an embedded ICC profile
+
+HYPER2COLOR=${HYPER2COLOR:-../src/hyper2color}
+WRITECUBE=${WRITECUBE:-./writecube}
+TIFFCOMPARE=${TIFFCOMPARE:-./tiffcompare}
+
+WIDTH=61
+HEIGHT=48
+BANDS=40
+WAVELENGTHS=$(seq 400 10 790 | paste -sd, -)
+
+dir=direct_tiff.$$
+mkdir -p $dir || exit 99
+trap 'rm -rf $dir' EXIT
+
+# Empty scanlines at the top and bottom give a partly transparent alpha channel
+truncate -s $(( WIDTH * HEIGHT * BANDS * 2 )) $dir/cube.raw || exit 99
+$WRITECUBE $dir/cube.raw $WIDTH $BANDS 4 $(( HEIGHT - 8 )) || exit 99
+
+status=0
+for bigtiff in no yes; do
+  for alpha in "" --alpha; do
+    for colorspace in sRGB AdobeRGB CIELAB; do
+      for bits in 8 16 32; do
+	options="-s $colorspace -b $bits --bigtiff $bigtiff --strip-rows 5 $alpha"
+	$HYPER2COLOR -i $dir/cube.raw -x $WIDTH -y $HEIGHT -c $BANDS -w $WAVELENGTHS \
+	  $options -o $dir/direct.tif > /dev/null || exit 1
+	$HYPER2COLOR -i $dir/cube.raw -x $WIDTH -y $HEIGHT -c $BANDS -w $WAVELENGTHS \
+	  $options -m lzw -o $dir/libtiff.tif > /dev/null || exit 1
+	if ! $TIFFCOMPARE $dir/direct.tif $dir/libtiff.tif; then
+	  echo "Direct output differs from libtiff output: $options"
+	  status=1
+	fi
+      done
+    done
+  done
+done
+
+exit $status
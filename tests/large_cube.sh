@@ -0,0 +1,68 @@
+#!/bin/sh
+#
+# Render and probe scanlines of a sparse raw cube of more than 4GB, which lie
+# beyond 32 bit file offsets, and check that they match the same scanlines
+# rendered from a small cube. The block of known scanlines straddles the 4GB
+# offset and runs to the end of the cube. A cube cut short must fail to render
+
+HYPER2COLOR=${HYPER2COLOR:-../src/hyper2color}
+WRITECUBE=${WRITECUBE:-./writecube}
+
+WIDTH=256
+BANDS=160
+HEIGHT=52500
+FIRST=52400
+LINES=100
+LINE_SIZE=$(( WIDTH * BANDS * 2 ))
+WAVELENGTHS=$(seq 400 3 877 | paste -sd, -)
+
+dir=large_cube.$$
+mkdir -p $dir || exit 99
+trap 'rm -rf $dir' EXIT
+
+# Sparse files are needed so as not to fill the disk
+if ! truncate -s $(( HEIGHT * LINE_SIZE )) $dir/big.raw; then
+  echo "Sparse files are not available"
+  exit 77
+fi
+
+$WRITECUBE $dir/big.raw $WIDTH $BANDS $FIRST $LINES || exit 99
+$WRITECUBE $dir/small.raw $WIDTH $BANDS 0 $LINES || exit 99
+
+# Rendered scanlines
+$HYPER2COLOR -i $dir/big.raw -x $WIDTH -y $HEIGHT -c $BANDS -w $WAVELENGTHS \
+  -b 16 --format raw -o $dir/big.out > /dev/null || exit 1
+$HYPER2COLOR -i $dir/small.raw -x $WIDTH -y $LINES -c $BANDS -w $WAVELENGTHS \
+  -b 16 --format raw -o $dir/small.out > /dev/null || exit 1
+
+size=$(( LINES * WIDTH * 3 * 2 ))
+tail -c $size $dir/big.out | cmp - $dir/small.out || { echo "Rendered scanlines beyond 4GB differ"; exit 1; }
+
+# Probed pixels, compared without their coordinates
+: > $dir/big.txt
+: > $dir/small.txt
+for y in 0 28 29 57 99; do
+  for x in 0 101 255; do
+    echo "$x,$(( FIRST + y ))" >> $dir/big.txt
+    echo "$x,$y" >> $dir/small.txt
+  done
+done
+
+$HYPER2COLOR -i $dir/big.raw -x $WIDTH -y $HEIGHT -c $BANDS -w $WAVELENGTHS \
+  -P $dir/big.txt -o $dir/big.csv > /dev/null || exit 1
+$HYPER2COLOR -i $dir/small.raw -x $WIDTH -y $LINES -c $BANDS -w $WAVELENGTHS \
+  -P $dir/small.txt -o $dir/small.csv > /dev/null || exit 1
+
+cut -d, -f3- $dir/big.csv > $dir/big.values
+cut -d, -f3- $dir/small.csv > $dir/small.values
+cmp $dir/big.values $dir/small.values || { echo "Probed spectra beyond 4GB differ"; exit 1; }
+
+# Truncated cube, missing the end of its last scanline
+truncate -s $(( HEIGHT * LINE_SIZE - 2 )) $dir/big.raw || exit 99
+if $HYPER2COLOR -i $dir/big.raw -x $WIDTH -y $HEIGHT -c $BANDS -w $WAVELENGTHS \
+  -b 16 --format raw -o $dir/big.out > /dev/null 2>&1; then
+  echo "Truncated cube rendered without error"
+  exit 1
+fi
+
+exit 0
@@ -0,0 +1,41 @@
+#!/bin/sh
+#
+# Check that strips and tiles compressed with our LZW encoder, with each
+# predictor and sample format, read back through libtiff with the same pixels
+# as uncompressed output. Strips are wide enough for the code table to fill
+# and be cleared several times within each strip
+
+HYPER2COLOR=${HYPER2COLOR:-../src/hyper2color}
+WRITECUBE=${WRITECUBE:-./writecube}
+TIFFCOMPARE=${TIFFCOMPARE:-./tiffcompare}
+
+WIDTH=997
+HEIGHT=60
+BANDS=30
+WAVELENGTHS=$(seq 400 10 690 | paste -sd, -)
+
+dir=lzw_strips.$$
+mkdir -p $dir || exit 99
+trap 'rm -rf $dir' EXIT
+
+truncate -s $(( WIDTH * HEIGHT * BANDS * 2 )) $dir/cube.raw || exit 99
+$WRITECUBE $dir/cube.raw $WIDTH $BANDS 0 $HEIGHT || exit 99
+
+status=0
+for layout in "--strip-rows 7" "-T 64"; do
+  for bits in 8 16 32 16f; do
+    for predictor in none horizontal float; do
+      options="-b $bits $layout"
+      $HYPER2COLOR -i $dir/cube.raw -x $WIDTH -y $HEIGHT -c $BANDS -w $WAVELENGTHS \
+	$options -o $dir/none.tif > /dev/null || exit 1
+      $HYPER2COLOR -i $dir/cube.raw -x $WIDTH -y $HEIGHT -c $BANDS -w $WAVELENGTHS \
+	$options -m lzw --predictor $predictor -o $dir/lzw.tif > /dev/null || exit 1
+      if ! $TIFFCOMPARE $dir/none.tif $dir/lzw.tif; then
+	echo "LZW output differs from uncompressed output: $options --predictor $predictor"
+	status=1
+      fi
+    done
+  done
+done
+
+exit $status
@@ -0,0 +1,244 @@
+/*
+    Compare two TIFF images tag by tag and pixel by pixel
+
+    Copyright (c) 2015-2024, Ruven <ruven@users.sourceforge.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+
+*/
+
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <tiffio.h>
+
+
+/* Any libtiff error or warning while reading counts as a failure
+ */
+static int problems = 0;
+
+static void report( const char *module, const char *fmt, va_list ap )
+{
+  printf( "%s: ", module ? module : "libtiff" );
+  vprintf( fmt, ap );
+  printf( "\n" );
+  problems++;
+}
+
+
+
+/* Compare a tag with a single 16 or 32 bit integer value
+ */
+static int compare_integer( TIFF *a, TIFF *b, ttag_t tag, const char *name, size_t size )
+{
+  uint32_t va = 0, vb = 0;
+  int ha, hb;
+
+  if( size == 2 ){
+    uint16_t sa = 0, sb = 0;
+    ha = TIFFGetField( a, tag, &sa );
+    hb = TIFFGetField( b, tag, &sb );
+    va = sa;
+    vb = sb;
+  }
+  else{
+    ha = TIFFGetField( a, tag, &va );
+    hb = TIFFGetField( b, tag, &vb );
+  }
+
+  if( ha != hb || va != vb ){
+    printf( "%s differs: %u and %u\n", name, va, vb );
+    return 1;
+  }
+  return 0;
+}
+
+
+
+/* Compare a tag with a single floating point value
+ */
+static int compare_float( TIFF *a, TIFF *b, ttag_t tag, const char *name )
+{
+  float va = 0.0f, vb = 0.0f;
+  int ha = TIFFGetField( a, tag, &va );
+  int hb = TIFFGetField( b, tag, &vb );
+
+  if( ha != hb || va != vb ){
+    printf( "%s differs: %g and %g\n", name, va, vb );
+    return 1;
+  }
+  return 0;
+}
+
+
+
+/* Compare an ASCII tag
+ */
+static int compare_string( TIFF *a, TIFF *b, ttag_t tag, const char *name )
+{
+  char *va = NULL, *vb = NULL;
+  int ha = TIFFGetField( a, tag, &va );
+  int hb = TIFFGetField( b, tag, &vb );
+
+  if( ha != hb || ( ha && strcmp( va, vb ) != 0 ) ){
+    printf( "%s differs\n", name );
+    return 1;
+  }
+  return 0;
+}
+
+
+
+/* Compare a tag with a count followed by an array of the given element size
+ */
+static int compare_array( TIFF *a, TIFF *b, ttag_t tag, const char *name, size_t element )
+{
+  uint32_t ca = 0, cb = 0;
+  void *va = NULL, *vb = NULL;
+  int ha, hb;
+
+  if( element == 2 ){
+    uint16_t sa = 0, sb = 0;
+    ha = TIFFGetField( a, tag, &sa, &va );
+    hb = TIFFGetField( b, tag, &sb, &vb );
+    ca = sa;
+    cb = sb;
+  }
+  else{
+    ha = TIFFGetField( a, tag, &ca, &va );
+    hb = TIFFGetField( b, tag, &cb, &vb );
+  }
+
+  if( ha != hb || ca != cb || ( ha && memcmp( va, vb, ca * element ) != 0 ) ){
+    printf( "%s differs\n", name );
+    return 1;
+  }
+  return 0;
+}
+
+
+
+/* Compare the first directory of a TIFF written directly with one written by
+   libtiff. Both must have the same tags other than compression and strip layout
+   and the same decoded pixels of each strip or tile. The first image must be
+   uncompressed
+
+   usage: tiffcompare direct.tif libtiff.tif
+ */
+int main( int argc, char **argv )
+{
+  TIFF *a, *b;
+  uint16_t compression, extra_a = 0, extra_b = 0, *samples_a = NULL, *samples_b = NULL;
+  tmsize_t size;
+  uint32_t chunks, s;
+  unsigned char *da, *db;
+  int tiled, status = 0;
+
+  if( argc != 3 ){
+    printf( "usage: %s direct.tif libtiff.tif\n", argv[0] );
+    return 1;
+  }
+
+  TIFFSetErrorHandler( report );
+  TIFFSetWarningHandler( report );
+
+  if( ! ( a = TIFFOpen( argv[1], "r" ) ) || ! ( b = TIFFOpen( argv[2], "r" ) ) ){
+    printf( "Unable to open TIFF images\n" );
+    return 1;
+  }
+
+  if( TIFFIsBigEndian( a ) != TIFFIsBigEndian( b ) || TIFFIsBigTIFF( a ) != TIFFIsBigTIFF( b ) ){
+    printf( "TIFF header differs\n" );
+    status = 1;
+  }
+
+  TIFFGetField( a, TIFFTAG_COMPRESSION, &compression );
+  if( compression != COMPRESSION_NONE ){
+    printf( "Direct output is compressed\n" );
+    status = 1;
+  }
+
+  status |= compare_integer( a, b, TIFFTAG_IMAGEWIDTH, "ImageWidth", 4 );
+  status |= compare_integer( a, b, TIFFTAG_IMAGELENGTH, "ImageLength", 4 );
+  status |= compare_integer( a, b, TIFFTAG_BITSPERSAMPLE, "BitsPerSample", 2 );
+  status |= compare_integer( a, b, TIFFTAG_PHOTOMETRIC, "PhotometricInterpretation", 2 );
+  status |= compare_string( a, b, TIFFTAG_IMAGEDESCRIPTION, "ImageDescription" );
+  status |= compare_integer( a, b, TIFFTAG_ORIENTATION, "Orientation", 2 );
+  status |= compare_integer( a, b, TIFFTAG_SAMPLESPERPIXEL, "SamplesPerPixel", 2 );
+  if( ( tiled = TIFFIsTiled( a ) ) != TIFFIsTiled( b ) ){
+    printf( "Only one image is tiled\n" );
+    return 1;
+  }
+  if( tiled ){
+    status |= compare_integer( a, b, TIFFTAG_TILEWIDTH, "TileWidth", 4 );
+    status |= compare_integer( a, b, TIFFTAG_TILELENGTH, "TileLength", 4 );
+  }
+  else status |= compare_integer( a, b, TIFFTAG_ROWSPERSTRIP, "RowsPerStrip", 4 );
+  status |= compare_float( a, b, TIFFTAG_XRESOLUTION, "XResolution" );
+  status |= compare_float( a, b, TIFFTAG_YRESOLUTION, "YResolution" );
+  status |= compare_integer( a, b, TIFFTAG_PLANARCONFIG, "PlanarConfiguration", 2 );
+  status |= compare_integer( a, b, TIFFTAG_RESOLUTIONUNIT, "ResolutionUnit", 2 );
+  status |= compare_string( a, b, TIFFTAG_SOFTWARE, "Software" );
+  status |= compare_integer( a, b, TIFFTAG_SAMPLEFORMAT, "SampleFormat", 2 );
+  status |= compare_array( a, b, TIFFTAG_ICCPROFILE, "ICCProfile", 1 );
+
+  /* Extra samples have a 16 bit count
+   */
+  TIFFGetField( a, TIFFTAG_EXTRASAMPLES, &extra_a, &samples_a );
+  TIFFGetField( b, TIFFTAG_EXTRASAMPLES, &extra_b, &samples_b );
+  if( extra_a != extra_b || ( extra_a && memcmp( samples_a, samples_b, extra_a * 2 ) != 0 ) ){
+    printf( "ExtraSamples differs\n" );
+    status = 1;
+  }
+
+  /* Decoded pixels of each strip or tile
+   */
+  chunks = tiled ? TIFFNumberOfTiles( a ) : TIFFNumberOfStrips( a );
+  if( chunks != ( tiled ? TIFFNumberOfTiles( b ) : TIFFNumberOfStrips( b ) ) ){
+    printf( "Number of %s differs\n", tiled ? "tiles" : "strips" );
+    status = 1;
+  }
+  else{
+    size = tiled ? TIFFTileSize( a ) : TIFFStripSize( a );
+    da = malloc( size );
+    db = malloc( size );
+    for( s=0; s<chunks; s++ ){
+      tmsize_t na = tiled ? TIFFReadEncodedTile( a, s, da, size ) : TIFFReadEncodedStrip( a, s, da, size );
+      tmsize_t nb = tiled ? TIFFReadEncodedTile( b, s, db, size ) : TIFFReadEncodedStrip( b, s, db, size );
+      if( na < 0 || na != nb || memcmp( da, db, na ) != 0 ){
+	printf( "Pixels of %s %u differ\n", tiled ? "tile" : "strip", s );
+	status = 1;
+	break;
+      }
+    }
+    free( da );
+    free( db );
+  }
+
+  if( TIFFReadDirectory( a ) || TIFFReadDirectory( b ) ){
+    printf( "Unexpected additional directory\n" );
+    status = 1;
+  }
+
+  TIFFClose( a );
+  TIFFClose( b );
+
+  if( problems ) status = 1;
+
+  return status;
+}
@@ -0,0 +1,87 @@
+/*
+    Write a synthetic raw BIL test cube
+
+    Copyright (c) 2015-2024, Ruven <ruven@users.sourceforge.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software Foundation,
+    Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+
+*/
+
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+
+
+/* Known 16 bit value of a band of a pixel of a test scanline, which depends only on
+   the position of the scanline within the block we write
+ */
+static unsigned short test_value( unsigned int line, unsigned int x, unsigned int band )
+{
+  return 1000 + ( line * 7919u + x * 104729u + band * 613u ) % 60000u;
+}
+
+
+
+/* Write a block of scanlines of a raw 16 bit BIL cube at their 64 bit file offsets
+   without touching the rest of the file, which may be sparse
+
+   usage: writecube file width bands first_line lines
+ */
+int main( int argc, char **argv )
+{
+  unsigned int width, bands, first, lines, j, x, k;
+  unsigned short *scanline;
+  size_t line_size;
+  int fd;
+
+  if( argc != 6 ){
+    printf( "usage: %s file width bands first_line lines\n", argv[0] );
+    return 1;
+  }
+
+  width = atoi( argv[2] );
+  bands = atoi( argv[3] );
+  first = atoi( argv[4] );
+  lines = atoi( argv[5] );
+  line_size = (size_t) width * bands * sizeof(unsigned short);
+
+  if( ( fd = open( argv[1], O_WRONLY | O_CREAT, 0644 ) ) == -1 ){
+    printf( "Unable to open '%s'\n", argv[1] );
+    return 1;
+  }
+
+  scanline = malloc( line_size );
+  for( j=0; j<lines; j++ ){
+    off_t offset = (off_t)( (uint64_t)( first + j ) * line_size );
+    for( k=0; k<bands; k++ ){
+      for( x=0; x<width; x++ ) scanline[(size_t)k*width + x] = test_value( j, x, k );
+    }
+    if( pwrite( fd, scanline, line_size, offset ) != (ssize_t) line_size ){
+      printf( "Unable to write scanline %u of '%s'\n", first + j, argv[1] );
+      free( scanline );
+      close( fd );
+      return 1;
+    }
+  }
+
+  free( scanline );
+  close( fd );
+
+  return 0;
+}